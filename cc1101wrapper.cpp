@@ -42,6 +42,7 @@
 
 #include <cc1101.h>
 #include <ccpacket.h>
+#include <SPI.h>
 
 //#define CC1101WRAPPER_DEBUG
 
@@ -57,29 +58,223 @@
 
 #endif
 
-CC1101 radio;
 byte syncWord[2] = {0xA9, 0x5A};
 
-void cc1101_init(byte* max_data_len, bool reset_only) {
+// PATABLE values at 868 MHz, for -30, -20, -15, -10, 0, 5, 7 and 10 dBm (see
+// TI design note DN013)
+static const byte pa_levels[CC1101_NB_POWER_LEVELS] PROGMEM = {
+    0x03, 0x0F, 0x1E, 0x27, 0x50, 0x81, 0xCB, 0xC2
+};
+
+// In the same order as pa_levels
+const uint32_t cc1101_tx_currents_ua[CC1101_NB_POWER_LEVELS] = {
+    12100, 12700, 13500, 14500, 16800, 20000, 25800, 29200
+};
+
+// Data rate profiles (26 MHz crystal), GFSK: MDMCFG4 (channel bandwidth and
+// data rate exponent), MDMCFG3 (data rate mantissa) and DEVIATN.
+// Profile 0 is arduino-cc1101 default setting.
+const uint32_t cc1101_rate_bitrates[CC1101_NB_RATES] = {
+    38400, 76800, 100000, 250000
+};
+static const byte rate_profiles[CC1101_NB_RATES][3] PROGMEM = {
+    { 0xCA, 0x83, 0x35 },   //  38.4 kBaud, RX BW 101 kHz, dev. 20.6 kHz
+    { 0x7B, 0x83, 0x42 },   //  76.8 kBaud, RX BW 232 kHz, dev. 32 kHz
+    { 0x5B, 0xF8, 0x47 },   //   100 kBaud, RX BW 325 kHz, dev. 47.6 kHz
+    { 0x2D, 0x3B, 0x62 }    //   250 kBaud, RX BW 541 kHz, dev. 127 kHz
+};
+
+// MCSM1: CCA mode 3 (default), stay in RX after a packet is received (so that
+// back-to-back packets are all received), go to IDLE after a packet is sent.
+#define MCSM1_VALUE                    0x3C
+
+// PKTCTRL1: append status bytes, with or without address check.
+// Address check is ADR_CHK = 11, that accepts both 0x00 and 0xFF as broadcast
+// addresses (arduino-cc1101 enableAddressCheck() sets 10, 0x00 only), as link
+// broadcasts to ADDR_BROADCAST (0xFF). No address check is ADR_CHK = 00, as
+// snif mode must see every frame.
+#define PKTCTRL1_ADDR_CHECK            0x07
+#define PKTCTRL1_NO_ADDR_CHECK         0x04
+
+// Wake-on-radio (see OPT_WOR_PERIOD)
+// MCSM1 in WOR: go to IDLE after a packet is received, so that device is put
+// back to WOR once the packet is read.
+#define MCSM1_WOR_VALUE                0x30
+// MCSM2: RX timeout (RX_TIME) is left to run out unless sync word is found or
+// preamble quality is reached. RX_TIME 7 (reset value) means no timeout.
+#define MCSM2_WOR_QUAL                 0x08
+#define MCSM2_VALUE                    0x07
+// WORCTRL: RC oscillator on, EVENT1 of 48 clock periods, RC oscillator
+// calibration, EVENT0 resolution of 1 period (WOR_RES = 0).
+#define WORCTRL_VALUE                  0x78
+// EVENT0 periods per second (26 MHz crystal / 750)
+#define WOR_EVENT0_PER_SECOND          34667UL
+
+// Shadow of configuration registers (0x00 to 0x2E), so that a register is
+// written only when its value changes, and device is re-initialized after a
+// reset with one burst write.
+#define NB_CONFIG_REGS                 0x2F
+// FSTEST, PTEST and AGCTEST (0x29 to 0x2B) are not to be written: burst
+// write stops at RCCTRL0, TEST2 to TEST0 are then written one by one.
+#define NB_BURST_REGS                  (CC1101_RCCTRL0 + 1)
+
+// One per device
+struct Dev {
+    CC1101 radio;
+    // Interrupt of GDO0 pin
+    byte interrupt;
+    // Chip select pin
+    byte cs;
+
+    // Link quality of last received packet
+    RxInfo last_rxinfo;
+
+    // Packets read out of RX FIFO, not yet handed over to RFLink. Same layout
+    // as in the FIFO: length byte, data, RSSI byte, LQI/CRC byte.
+    byte rxq[CC1101_FIFO_SIZE];
+    byte rxq_len;
+    byte rxq_pos;
+
+    byte shadow[NB_CONFIG_REGS];
+    byte shadow_pa;
+
+    // Device is in WOR when listening (see OPT_WOR_PERIOD)
+    bool wor;
+
+    Dev():interrupt(CC1101Interrupt),cs(SS),rxq_len(0),rxq_pos(0),wor(false) { }
+};
+
+static Dev devs[CC1101_MAX_DEVICES];
+
+static void reg_write(Dev* d, byte addr, byte value) {
+    if (d->shadow[addr] != value) {
+        d->radio.writeReg(addr, value);
+        d->shadow[addr] = value;
+    }
+}
+
+static void pa_write(Dev* d, byte value) {
+    if (d->shadow_pa != value) {
+        d->radio.setTxPowerAmp(value);
+        d->shadow_pa = value;
+    }
+}
+
+static void shadow_load(Dev* d) {
+    for (byte i = 0; i < NB_CONFIG_REGS; ++i)
+        d->shadow[i] = d->radio.readConfigReg(i);
+}
+
+// TEST2 to TEST0 are also lost when device sleeps (WOR)
+static void test_write(Dev* d) {
+    d->radio.writeReg(CC1101_TEST2, d->shadow[CC1101_TEST2]);
+    d->radio.writeReg(CC1101_TEST1, d->shadow[CC1101_TEST1]);
+    d->radio.writeReg(CC1101_TEST0, d->shadow[CC1101_TEST0]);
+}
+
+// Back to listening: RX state, or WOR (that can only be entered from IDLE
+// state).
+static void rx_resume(Dev* d) {
+    if (d->wor) {
+        d->radio.setIdleState();
+        d->radio.cmdStrobe(CC1101_SWOR);
+    } else {
+        d->radio.setRxState();
+    }
+}
+
+// MARCSTATE values (see CC1101 datasheet, section 29.3)
+#define MARCSTATE_IDLE                 0x01
+#define MARCSTATE_RX                   0x0D
+#define MARCSTATE_RXFIFO_OVERFLOW      0x11
+#define MARCSTATE_TX                   0x13
+#define MARCSTATE_TX_END               0x14
+#define MARCSTATE_RXTX_SWITCH          0x15
+#define MARCSTATE_TXFIFO_UNDERFLOW     0x16
+
+static bool wait_marcstate(Dev* d, byte state) {
+    mtime_t t0 = millis();
+    while ((d->radio.readStatusReg(CC1101_MARCSTATE) & 0x1F) != state) {
+        if (millis() - t0 >= CC1101_RECOVER_WAIT)
+            return false;
+    }
+    return true;
+}
+
+// Out of WOR before a sending: device is left in IDLE state, with TEST
+// registers restored, RX state (and calibration) comes next.
+static void wor_leave(Dev* d) {
+    d->radio.setIdleState();
+    wait_marcstate(d, MARCSTATE_IDLE);
+    test_write(d);
+}
+
+// Same as radio.sendData(): RX state is entered before STX strobe, so that CCA
+// is assessed. Coming from IDLE, device first goes through frequency
+// synthesizer calibration (MARCSTATE 0x08 to 0x0C), that is waited out.
+static bool rx_enter(Dev* d) {
+    d->radio.setRxState();
+    mtime_t t0 = millis();
+    byte marcstate;
+    while ((marcstate = d->radio.readStatusReg(CC1101_MARCSTATE) & 0x1F)
+           != MARCSTATE_RX) {
+        if (marcstate == MARCSTATE_RXFIFO_OVERFLOW) {
+            d->radio.flushRxFifo();
+            d->radio.setRxState();
+        }
+        if (millis() - t0 >= CC1101_RECOVER_WAIT)
+            return false;
+    }
+    return true;
+}
+
+// Done straight through SPI, as burst functions of arduino-cc1101 are not
+// public.
+static void shadow_burst_write(Dev* d) {
+    digitalWrite(d->cs, LOW);
+    while (digitalRead(MISO))
+        ;
+    SPI.transfer(0x00 | CC1101_WRITE_BURST);
+    for (byte i = 0; i < NB_BURST_REGS; ++i)
+        SPI.transfer(d->shadow[i]);
+    digitalWrite(d->cs, HIGH);
+
+    test_write(d);
+}
+
+void cc1101_init(byte dev, byte* max_data_len, bool reset_only) {
+    Dev* d = &devs[dev];
+    d->rxq_len = 0;
+    d->rxq_pos = 0;
     if (reset_only) {
         dbg("Resetting radio...");
-        radio.reset();
+        d->radio.cmdStrobe(CC1101_SRES);
+        shadow_burst_write(d);
+        d->radio.setTxPowerAmp(d->shadow_pa);
+        rx_resume(d);
         dbg("Radio reset done");
         return;
     }
-    radio.init();
-    radio.setSyncWord(syncWord);
-    radio.setCarrierFreq(CFREQ_868);
-    radio.enableAddressCheck();
+    d->wor = false;
+    d->radio.init();
+    d->radio.setSyncWord(syncWord);
+    d->radio.setCarrierFreq(CFREQ_868);
+    shadow_load(d);
+    d->shadow_pa = PA_LowPower;
+    d->radio.setTxPowerAmp(d->shadow_pa);
+    reg_write(d, CC1101_PKTCTRL1, PKTCTRL1_ADDR_CHECK);
+    reg_write(d, CC1101_MCSM1, MCSM1_VALUE);
     if (max_data_len)
         *max_data_len = (CCPACKET_DATA_LEN);
 }
 
-void cc1101_set_opt(opt_t opt, void *data, byte len) {
+void cc1101_set_opt(byte dev, opt_t opt, void *data, byte len) {
+    Dev* d = &devs[dev];
     if (opt == OPT_ADDRESS && len == 1) {
         // Set device address
         byte addr = *(byte*)data;
-        radio.setDevAddress(addr);
+        reg_write(d, CC1101_ADDR, addr);
+        d->radio.devAddress = addr;
         dbgf("Set device address to: 0x%02x", addr);
 
     } else if (opt == OPT_EMISSION_POWER && len == 1) {
@@ -96,36 +291,171 @@ void cc1101_set_opt(opt_t opt, void *data, byte len) {
             pa_value = PA_LongDistance;
             dbg("Set device PA to high power");
         }
-        radio.setTxPowerAmp(pa_value);
+        pa_write(d, pa_value);
+
+    } else if (opt == OPT_EMISSION_POWER_LEVEL && len == 1) {
+        byte level = *(byte*)data;
+        if (level >= CC1101_NB_POWER_LEVELS)
+            level = CC1101_NB_POWER_LEVELS - 1;
+        pa_write(d, pgm_read_byte(&pa_levels[level]));
+        dbgf("Set device PA level to %i", level);
+
+    } else if (opt == OPT_DATA_RATE && len == 1) {
+        byte rate = *(byte*)data;
+        if (rate >= CC1101_NB_RATES)
+            rate = CC1101_NB_RATES - 1;
+        byte mdmcfg4 = pgm_read_byte(&rate_profiles[rate][0]);
+        byte mdmcfg3 = pgm_read_byte(&rate_profiles[rate][1]);
+        byte deviatn = pgm_read_byte(&rate_profiles[rate][2]);
+        if (d->shadow[CC1101_MDMCFG4] == mdmcfg4
+            && d->shadow[CC1101_MDMCFG3] == mdmcfg3
+            && d->shadow[CC1101_DEVIATN] == deviatn) {
+            return;
+        }
+        // Configuration registers are to be written in IDLE state
+        d->radio.setIdleState();
+        reg_write(d, CC1101_MDMCFG4, mdmcfg4);
+        reg_write(d, CC1101_MDMCFG3, mdmcfg3);
+        reg_write(d, CC1101_DEVIATN, deviatn);
+        rx_resume(d);
+        dbgf("Set device data rate to profile %i", rate);
+
+    } else if (opt == OPT_CHANNEL && len == 1) {
+        byte channel = *(byte*)data;
+        if (d->shadow[CC1101_CHANNR] == channel)
+            return;
+        // Frequency synthesizer is calibrated when going from IDLE to RX
+        d->radio.setIdleState();
+        reg_write(d, CC1101_CHANNR, channel);
+        d->radio.channel = channel;
+        rx_resume(d);
+        dbgf("Set device channel to %i", channel);
 
     } else if (opt == OPT_SNIF_MODE && len == 1) {
         byte val = *(byte*)data;
         if (val) {
-            radio.disableAddressCheck();
+            reg_write(d, CC1101_PKTCTRL1, PKTCTRL1_NO_ADDR_CHECK);
             dbg("Disabled address check (a.k.a. snif mode)");
         } else {
-            radio.enableAddressCheck();
+            reg_write(d, CC1101_PKTCTRL1, PKTCTRL1_ADDR_CHECK);
             dbg("Enabled address check (a.k.a. non-snif mode)");
         }
 
+    } else if (opt == OPT_WOR_PERIOD && len == 2) {
+        uint16_t period = *(uint16_t*)data;
+        d->radio.setIdleState();
+        if (period) {
+            if (period > CC1101_WOR_MAX_PERIOD)
+                period = CC1101_WOR_MAX_PERIOD;
+            uint16_t event0 = (uint32_t)period * WOR_EVENT0_PER_SECOND / 1000;
+            // RX timeout is one eighth of EVENT0 period with RX_TIME 0, halved
+            // at each RX_TIME step (see CC1101 datasheet, section 19.5).
+            byte rx_time = 0;
+            while (rx_time < 6
+                   && (period >> (rx_time + 4)) >= CC1101_WOR_RX_MIN_TIME) {
+                ++rx_time;
+            }
+            reg_write(d, CC1101_WOREVT1, event0 >> 8);
+            reg_write(d, CC1101_WOREVT0, event0 & 0xFF);
+            reg_write(d, CC1101_WORCTRL, WORCTRL_VALUE);
+            reg_write(d, CC1101_MCSM2, MCSM2_WOR_QUAL | rx_time);
+            reg_write(d, CC1101_MCSM1, MCSM1_WOR_VALUE);
+            d->wor = true;
+            dbgf("Set device WOR period to %u ms, RX_TIME %i", period,
+                 rx_time);
+        } else if (d->wor) {
+            reg_write(d, CC1101_MCSM2, MCSM2_VALUE);
+            reg_write(d, CC1101_MCSM1, MCSM1_VALUE);
+            test_write(d);
+            d->wor = false;
+            dbg("Disabled device WOR");
+        }
+        rx_resume(d);
+
     } else {
         dbgf("Error: unknown option code: %i", opt);
     }
 }
 
-// FIXME
-// cc1101wrapper copies data from caller before handing over to
-// sendData method of radio object.
-// Using user data directly would be best.
-byte cc1101_send(const void *data, byte len) {
-    CCPACKET packet;
-    packet.length = len;
-    memcpy(packet.data, data, len);
-
-    dbgf("cc1101_send: sending packet of %i byte(s):", len);
-    dbgbin("cc1101_send:   ", packet.data, len);
-    bool r = radio.sendData(packet);
-    dbgf("cc1101_send: sendData return value: %i", r);
+// radio.sendData() waits for the end of transmission on GDO0 pin of device 0:
+// transmission is started, then polled, on device dev instead.
+byte cc1101_send(byte dev, const void *data, byte len) {
+    byte r = cc1101_send_start(dev, data, len);
+    if (r != ERR_OK)
+        return r;
+
+    mtime_t t0 = millis();
+    while ((r = cc1101_send_poll(dev)) == ERR_SEND_IN_PROGRESS) {
+        if (millis() - t0 >= CC1101_TX_WAIT) {
+            Dev* d = &devs[dev];
+            d->radio.setIdleState();
+            d->radio.flushTxFifo();
+            rx_resume(d);
+            return ERR_SEND_IO;
+        }
+    }
+    return r;
+}
+
+// Same as radio.sendData(), except that it does not wait for the end of
+// transmission (see cc1101_send_poll()).
+byte cc1101_send_start(byte dev, const void *data, byte len) {
+    Dev* d = &devs[dev];
+    if (d->wor)
+        wor_leave(d);
+    byte marcstate = d->radio.readStatusReg(CC1101_MARCSTATE) & 0x1F;
+    if (marcstate == MARCSTATE_TX || marcstate == MARCSTATE_TX_END
+        || marcstate == MARCSTATE_RXTX_SWITCH) {
+        return ERR_SEND_IO;
+    }
+    if (marcstate != MARCSTATE_RX) {
+        if (!rx_enter(d)) {
+            d->radio.setIdleState();
+            rx_resume(d);
+            return ERR_SEND_IO;
+        }
+        // Let RSSI settle, for CCA (as in radio.sendData())
+        delayMicroseconds(500);
+    }
+
+    dbgf("cc1101_send_start: sending packet of %i byte(s):", len);
+    dbgbin("cc1101_send_start:   ", (const byte*)data, len);
+
+    d->radio.writeReg(CC1101_TXFIFO, len);
+    for (byte i = 0; i < len; ++i)
+        d->radio.writeReg(CC1101_TXFIFO, ((const byte*)data)[i]);
+    d->radio.setTxState();
+
+    // If CCA is enabled and the channel is busy, the device stays in RX state
+    marcstate = d->radio.readStatusReg(CC1101_MARCSTATE) & 0x1F;
+    if (marcstate != MARCSTATE_TX && marcstate != MARCSTATE_TX_END
+        && marcstate != MARCSTATE_RXTX_SWITCH) {
+        d->radio.setIdleState();
+        d->radio.flushTxFifo();
+        rx_resume(d);
+        return ERR_SEND_IO;
+    }
+
+    return ERR_OK;
+}
+
+// Once transmission is over, the device goes to IDLE state (MCSM1 TXOFF_MODE)
+byte cc1101_send_poll(byte dev) {
+    Dev* d = &devs[dev];
+    byte marcstate = d->radio.readStatusReg(CC1101_MARCSTATE) & 0x1F;
+    if (marcstate != MARCSTATE_IDLE && marcstate != MARCSTATE_RX
+        && marcstate != MARCSTATE_TXFIFO_UNDERFLOW) {
+        return ERR_SEND_IN_PROGRESS;
+    }
+
+    bool r = (marcstate != MARCSTATE_TXFIFO_UNDERFLOW
+              && !(d->radio.readStatusReg(CC1101_TXBYTES) & 0x7F));
+    if (!r) {
+        d->radio.setIdleState();
+        d->radio.flushTxFifo();
+    }
+    rx_resume(d);
+    dbgf("cc1101_send_poll: transmission over, status: %i", r);
 
     return r ? ERR_OK : ERR_SEND_IO;
 }
@@ -133,42 +463,200 @@ byte cc1101_send(const void *data, byte len) {
 // FIXME
 // Same remark as with cc1101_send: a lot of memcpy in the end, in the
 // way it is designed today.
-byte cc1101_receive(void *buf, byte buf_len) {
-    CCPACKET packet;
-    byte len;
-    if ((len = radio.receiveData(&packet))) {
+static void rx_flush(Dev* d) {
+    d->radio.setIdleState();
+    d->radio.flushRxFifo();
+    rx_resume(d);
+}
 
-        dbgf("cc1101_receive: %i byte(s) packet received:", len);
-        dbgbin("cc1101_receive:   ", packet.data, len);
+// Read every packet out of RX FIFO, into rxq.
+// The FIFO can hold several packets (see MCSM1_VALUE), the last one of which
+// can still be underway: it is then waited for, up to CC1101_RX_WAIT.
+static void rx_drain(Dev* d) {
+    byte rxbytes = d->radio.readStatusReg(CC1101_RXBYTES);
+    while (rxbytes) {
+        if (rxbytes & 0x80) {
+            dbg("cc1101_receive: RX FIFO overflow");
+            rx_flush(d);
+            return;
+        }
 
-        if (len > buf_len)
-            len = buf_len;
+        byte len = d->radio.readConfigReg(CC1101_RXFIFO);
+        if (len > CCPACKET_DATA_LEN
+            || d->rxq_len + len + 3 > (int)sizeof(d->rxq)) {
+            dbgf("cc1101_receive: bad packet length: %i", len);
+            rx_flush(d);
+            return;
+        }
 
-        memcpy(buf, packet.data, len);
-        return len;
-    } else {
-        return 0;
+        mtime_t t0 = millis();
+        while ((d->radio.readStatusReg(CC1101_RXBYTES) & 0x7F) < len + 2) {
+            if (millis() - t0 >= CC1101_RX_WAIT) {
+                dbg("cc1101_receive: incomplete packet");
+                rx_flush(d);
+                return;
+            }
+        }
+
+        d->rxq[d->rxq_len++] = len;
+        for (byte i = 0; i < len + 2; ++i)
+            d->rxq[d->rxq_len++] = d->radio.readConfigReg(CC1101_RXFIFO);
+
+        rxbytes = d->radio.readStatusReg(CC1101_RXBYTES);
+    }
+}
+
+// Hand over packets one at a time. RX FIFO is drained when there's none left
+// in rxq.
+byte cc1101_receive(byte dev, void *buf, byte buf_len) {
+    Dev* d = &devs[dev];
+    if (d->rxq_pos >= d->rxq_len) {
+        d->rxq_pos = 0;
+        d->rxq_len = 0;
+        rx_drain(d);
+        if (!d->rxq_len) {
+            if (d->wor)
+                rx_resume(d);
+            return 0;
+        }
+    }
+
+    byte len = d->rxq[d->rxq_pos];
+    const byte* data = &d->rxq[d->rxq_pos + 1];
+    byte raw_rssi = data[len];
+    byte lqi_crc = data[len + 1];
+    d->rxq_pos += len + 3;
+    if (d->wor && d->rxq_pos >= d->rxq_len)
+        rx_resume(d);
+
+    dbgf("cc1101_receive: %i byte(s) packet received:", len);
+    dbgbin("cc1101_receive:   ", data, len);
+
+    // RSSI offset of 74 dB applies at 868 MHz, 38.4 kBaud (see CC1101
+    // datasheet, section 17.3)
+    int rssi = raw_rssi;
+    if (rssi >= 128)
+        rssi -= 256;
+    d->last_rxinfo.rssi = rssi / 2 - 74;
+    d->last_rxinfo.lqi = lqi_crc & 0x7F;
+    d->last_rxinfo.crc_ok = (lqi_crc & 0x80);
+
+    if (len > buf_len)
+        len = buf_len;
+    memcpy(buf, data, len);
+    return len;
+}
+
+byte cc1101_pending_frames(byte dev) {
+    Dev* d = &devs[dev];
+    return d->rxq_pos < d->rxq_len;
+}
+
+// Cheaper than a reset: registers are left unchanged.
+// If the device does not reach the expected states in due time, it is
+// considered stuck.
+bool cc1101_recover(byte dev) {
+    Dev* d = &devs[dev];
+    d->rxq_len = 0;
+    d->rxq_pos = 0;
+
+    d->radio.setIdleState();
+    if (!wait_marcstate(d, MARCSTATE_IDLE))
+        return false;
+    d->radio.flushRxFifo();
+    d->radio.flushTxFifo();
+
+    d->radio.cmdStrobe(CC1101_SCAL);
+    if (!wait_marcstate(d, MARCSTATE_IDLE))
+        return false;
+
+    if (d->wor) {
+        rx_resume(d);
+        return true;
     }
+    d->radio.setRxState();
+    return wait_marcstate(d, MARCSTATE_RX);
+}
+
+void cc1101_get_rx_info(byte dev, RxInfo* info) {
+    Dev* d = &devs[dev];
+    *info = d->last_rxinfo;
+}
+
+// Relies on CC1101 CCA (Clear Channel Assessment) status, updated while in RX
+// state.
+bool cc1101_channel_is_clear(byte dev) {
+    Dev* d = &devs[dev];
+    byte st = d->radio.readStatusReg(CC1101_PKTSTATUS);
+    return (st & 0x10);
+}
+
+void cc1101_set_interrupt(byte dev, void (*func)()) {
+    Dev* d = &devs[dev];
+    attachInterrupt(d->interrupt, func, FALLING);
+}
+
+void cc1101_reset_interrupt(byte dev) {
+    Dev* d = &devs[dev];
+    detachInterrupt(d->interrupt);
 }
 
-void cc1101_set_interrupt(void (*func)()) {
-    attachInterrupt(CC1101Interrupt, func, FALLING);
+void cc1101_set_device_interrupt(byte dev, byte interrupt) {
+    devs[dev].interrupt = interrupt;
 }
 
-void cc1101_reset_interrupt() {
-    detachInterrupt(CC1101Interrupt);
+void cc1101_set_device_cs(byte dev, byte pin) {
+    devs[dev].cs = pin;
 }
 
-void cc1101_attach(RFLink* link) {
+CC1101* cc1101_get_radio(byte dev) {
+    return &devs[dev].radio;
+}
+
+// RFLinkFunctions members take no device argument: CC1101Driver static
+// member-functions are used instead.
+template <byte N> static void attach(RFLink* link) {
     RFLinkFunctions f;
-    f.deviceInit = cc1101_init;
-    f.deviceSend = cc1101_send;
-    f.deviceReceive = cc1101_receive;
-    f.deviceSetOpt = cc1101_set_opt;
+    f.deviceInit = CC1101Driver<N>::init;
+    f.deviceSend = CC1101Driver<N>::send;
+#ifdef CC1101_ASYNC_SEND
+    f.deviceSendStart = CC1101Driver<N>::send_start;
+    f.deviceSendPoll = CC1101Driver<N>::send_poll;
+#endif
+    f.deviceReceive = CC1101Driver<N>::receive;
+    f.deviceSetOpt = CC1101Driver<N>::set_opt;
+    f.deviceGetRxInfo = CC1101Driver<N>::get_rx_info_func;
+    f.devicePendingFrames = CC1101Driver<N>::pending_frames;
+    f.deviceRecover = CC1101Driver<N>::recover;
 
-    f.setInterrupt = cc1101_set_interrupt;
-    f.resetInterrupt = cc1101_reset_interrupt;
+    f.setInterrupt = CC1101Driver<N>::set_interrupt;
+    f.resetInterrupt = CC1101Driver<N>::reset_interrupt;
+
+    f.channelIsClear = CC1101Driver<N>::channel_is_clear;
 
     link->register_funcs(&f);
 }
 
+void cc1101_attach(RFLink* link, byte dev) {
+    switch (dev) {
+#if CC1101_MAX_DEVICES >= 2
+        case 1:
+            attach<1>(link);
+            break;
+#endif
+#if CC1101_MAX_DEVICES >= 3
+        case 2:
+            attach<2>(link);
+            break;
+#endif
+#if CC1101_MAX_DEVICES >= 4
+        case 3:
+            attach<3>(link);
+            break;
+#endif
+        default:
+            attach<0>(link);
+    }
+}
+
+template class RFLinkBase<CC1101Driver<0> >;
@@ -60,7 +60,149 @@
 #define CC1101_GDO0 2
 #endif
 
-void cc1101_attach(RFLink* link);
+#define CC1101_FIFO_SIZE 64
+// Max time waited for the end of a packet being received, in milliseconds
+#define CC1101_RX_WAIT 20
+// Max time waited for the end of a transmission, in milliseconds
+#define CC1101_TX_WAIT 100
+// Max time waited for each state change during recovery, in milliseconds
+#define CC1101_RECOVER_WAIT 2
+
+// Number of levels of OPT_EMISSION_POWER_LEVEL option
+#define CC1101_NB_POWER_LEVELS 8
+
+// Number of profiles of OPT_DATA_RATE option, and bitrate of each (to be
+// passed to RFLink::set_auto_rate())
+#define CC1101_NB_RATES 4
+extern const uint32_t cc1101_rate_bitrates[CC1101_NB_RATES];
+
+// Current drawn by CC1101 (in microamps) when sending at each emission power
+// level, and when receiving, to fill RFEnergyModel (see
+// RFLink::set_energy_model()). Typical figures of CC1101 datasheet, at 868
+// MHz.
+// NOTE
+//   The wrapper leaves device in RX state when not sending: idle current is
+//   receive current. With OPT_WOR_PERIOD, the average current drawn while
+//   listening is about receive current times the fraction of time device is
+//   awake (see CC1101_WOR_RX_MIN_TIME).
+extern const uint32_t cc1101_tx_currents_ua[CC1101_NB_POWER_LEVELS];
+#define CC1101_RX_CURRENT_UA 15700
+
+// OPT_CHANNEL option sets CHANNR register: channel n is at carrier frequency
+// plus n times channel spacing (about 200 kHz with default settings).
+
+// OPT_WOR_PERIOD option, period from 1 to CC1101_WOR_MAX_PERIOD milliseconds.
+// At each wake-up, device listens for CC1101_WOR_RX_MIN_TIME milliseconds
+// (enough for a frame plus WAKE_UP_ACK_GAP, so that a wake-up train is heard
+// whenever device wakes up), or one eighth of the period if shorter.
+// NOTE
+//   Any SPI access wakes device up: the wrapper puts it back to WOR after a
+//   sending or a reception.
+#define CC1101_WOR_MAX_PERIOD 1890
+#define CC1101_WOR_RX_MIN_TIME 20
+
+// Asynchronous sending (see deviceSendStart in RFLinkFunctions): the link goes
+// on with other tasks while device transmits, instead of waiting for the end of
+// transmission in cc1101_send(). Uncomment to enable it, in CC1101Driver and
+// in cc1101_attach().
+//#define CC1101_ASYNC_SEND
+
+// Number of CC1101 devices driven by the wrapper, from 1 to 4 (see
+// CC1101Driver).
+// *IMPORTANT*
+// arduino-cc1101 selects the device with SS pin: several devices require a
+// version of it where chip select pin is set per CC1101 object. The wrapper
+// itself uses the pin set with cc1101_set_device_cs() (register restore after
+// a reset), and waits for the end of a transmission by polling the device
+// (not on GDO0 pin of device 0, as radio.sendData() does).
+#define CC1101_MAX_DEVICES 1
+// Uncomment once arduino-cc1101 is adapted as said above. Unless it is, all
+// radio.*() calls would talk to the device on SS pin.
+//#define CC1101_PER_DEVICE_CS
+
+#if CC1101_MAX_DEVICES > 1 && !defined(CC1101_PER_DEVICE_CS)
+#error "SEVERAL CC1101 DEVICES NEED ARDUINO-CC1101 ADAPTED TO A CHIP SELECT PIN PER DEVICE, SEE CC1101_PER_DEVICE_CS"
+#endif
+
+class CC1101;
+
+// Interrupt (as in attachInterrupt()) of GDO0 pin of device dev.
+// Device 0 is CC1101Interrupt by default, other devices MUST be set, before
+// link is initialized.
+void cc1101_set_device_interrupt(byte dev, byte interrupt);
+// Chip select pin of device dev. Device 0 is SS by default, other devices
+// MUST be set, before link is initialized.
+void cc1101_set_device_cs(byte dev, byte pin);
+CC1101* cc1101_get_radio(byte dev);
+
+void cc1101_init(byte dev, byte* max_data_len, bool reset_only);
+byte cc1101_send(byte dev, const void *data, byte len);
+byte cc1101_send_start(byte dev, const void *data, byte len);
+byte cc1101_send_poll(byte dev);
+byte cc1101_receive(byte dev, void *buf, byte buf_len);
+byte cc1101_pending_frames(byte dev);
+void cc1101_set_opt(byte dev, opt_t opt, void *data, byte len);
+void cc1101_get_rx_info(byte dev, RxInfo* info);
+bool cc1101_recover(byte dev);
+bool cc1101_channel_is_clear(byte dev);
+void cc1101_set_interrupt(byte dev, void (*func)());
+void cc1101_reset_interrupt(byte dev);
+
+// Register functions of device dev into link, the driver is then bound at run
+// time
+void cc1101_attach(RFLink* link, byte dev = 0);
+
+// CC1101 driver bound at compile time, N being the device. Use it with
+// CC1101Link (device 0), or, for example:
+//   RFLinkBase<CC1101Driver<1> > link1;
+//   cc1101_set_device_interrupt(1, digitalPinToInterrupt(3));
+//   cc1101_set_device_cs(1, 9);
+//   link1.begin();
+template <byte N = 0>
+struct CC1101Driver : public RFDriver {
+    static_assert(N < CC1101_MAX_DEVICES, "CC1101_MAX_DEVICES is too low");
+
+    static void init(byte* max_data_len, bool reset_only) {
+        cc1101_init(N, max_data_len, reset_only);
+    }
+    static byte send(const void* data, byte len) {
+        return cc1101_send(N, data, len);
+    }
+    static byte receive(void* buf, byte buf_len) {
+        return cc1101_receive(N, buf, buf_len);
+    }
+    static void set_opt(opt_t opt, void* data, byte len) {
+        cc1101_set_opt(N, opt, data, len);
+    }
+    static void set_interrupt(void (*func)()) { cc1101_set_interrupt(N, func); }
+    static void reset_interrupt() { cc1101_reset_interrupt(N); }
+
+    static bool get_rx_info(RxInfo* info) {
+        cc1101_get_rx_info(N, info);
+        return true;
+    }
+    static void get_rx_info_func(RxInfo* info) { cc1101_get_rx_info(N, info); }
+
+#ifdef CC1101_ASYNC_SEND
+    static bool has_async_send() { return true; }
+#endif
+    static byte send_start(const void* data, byte len) {
+        return cc1101_send_start(N, data, len);
+    }
+    static byte send_poll() { return cc1101_send_poll(N); }
+
+    static byte pending_frames() { return cc1101_pending_frames(N); }
+
+    static bool has_recover() { return true; }
+    static bool recover() { return cc1101_recover(N); }
+
+    static bool channel_is_clear() { return cc1101_channel_is_clear(N); }
+};
+
+typedef RFLinkBase<CC1101Driver<0> > CC1101Link;
+
+// Instantiated once, in cc1101wrapper.cpp
+extern template class RFLinkBase<CC1101Driver<0> >;
 
 #endif // _CC1101WRAPPER_H
 
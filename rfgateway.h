@@ -0,0 +1,353 @@
+// vim:ts=4:sw=4:tw=80:et
+/*
+  rfgateway.h
+
+  Gateway over several links, each one having its own device, set on its own
+  channel.
+    - Sendings are routed to the link of the channel of destination node
+    - Packets received by all links are queued, to be read one at a time
+    - Load statistics are kept per channel
+*/
+
+/*
+  Copyright 2020 Sébastien Millet
+
+  rflink is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  rflink is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program. If not, see
+  <https://www.gnu.org/licenses>.
+*/
+
+#ifndef _RFGATEWAY_H
+#define _RFGATEWAY_H
+
+#include "rflink.h"
+
+#include <Arduino.h>
+
+// Number of received packets the gateway can hold, waiting to be read
+#define DEFAULT_GATEWAY_QUEUE_LEN              4
+// Data received beyond this length is truncated
+#define DEFAULT_GATEWAY_MAX_DATA_LEN          32
+
+// Channel of a node not assigned to any channel
+#define CHANNEL_NONE                        0x0F
+
+struct RFChannelStats {
+    uint16_t rx_pkts;       // Packets received
+    uint32_t rx_bytes;      // Data bytes received
+    uint16_t tx_pkts;       // Sendings
+    uint16_t tx_errors;     // Sendings that failed
+    byte nodes;             // Nodes assigned to channel
+#ifdef RFLINK_DUTY_CYCLE
+    mtime_t airtime_used;   // See RFLinkBase::get_airtime_used()
+#endif
+};
+
+// Link is the type of links, for example RFLink or
+// RFLinkBase<CC1101Driver<> >. Links are to be initialized (and their
+// device set on its channel, see OPT_CHANNEL) before the gateway is used.
+//
+// A node is assigned to a channel either with assign() or assign_auto(), or,
+// the first time a packet is received from it.
+// Sending to a node not assigned to any channel is done on channel 0.
+// Sending to ADDR_BROADCAST is done on all channels.
+template <class Link, byte NbChannels,
+          byte QueueLen = DEFAULT_GATEWAY_QUEUE_LEN,
+          byte MaxDataLen = DEFAULT_GATEWAY_MAX_DATA_LEN>
+class RFGateway {
+    static_assert(NbChannels >= 1 && NbChannels < CHANNEL_NONE,
+      "NbChannels must be between 1 and 14");
+    static_assert(QueueLen >= 1, "QueueLen must be at least 1");
+
+    private:
+
+        struct RcvdPkt {
+            byte channel;
+            address_t sender;
+            byte len;
+            RxInfo rxinfo;
+            byte data[MaxDataLen];
+        };
+
+        Link* links[NbChannels];
+        taskid_t rcv_taskids[NbChannels];
+        RFChannelStats stats[NbChannels];
+
+        // Channel of each node, two nodes per byte
+        byte node_channels[128];
+
+        RcvdPkt queue[QueueLen];
+        byte queue_head;
+        byte queue_count;
+
+        void set_channel(address_t node, byte channel);
+        void poll_link(byte channel);
+
+    public:
+        RFGateway();
+
+        void set_link(byte channel, Link* link);
+        Link* get_link(byte channel) const;
+
+        void assign(address_t node, byte channel);
+        byte assign_auto(address_t node);
+        byte get_channel(address_t node) const;
+
+        void do_events();
+
+        byte send(address_t dst, const void* data, byte len, bool ack,
+                  byte *nbsend = nullptr);
+
+        byte available() const;
+        byte receive(void* buf, byte buf_len, byte* rec_len,
+                     address_t* sender = nullptr, byte* channel = nullptr,
+                     RxInfo* rxinfo = nullptr);
+
+        void get_stats(byte channel, RFChannelStats* st) const;
+        void reset_stats();
+};
+
+template <class Link, byte NbChannels, byte QueueLen, byte MaxDataLen>
+RFGateway<Link, NbChannels, QueueLen, MaxDataLen>::RFGateway():
+      queue_head(0),
+      queue_count(0) {
+    for (byte c = 0; c < NbChannels; ++c) {
+        links[c] = nullptr;
+        rcv_taskids[c] = TASKID_NONE;
+    }
+    memset(node_channels, (CHANNEL_NONE << 4) | CHANNEL_NONE,
+           sizeof(node_channels));
+    memset(stats, 0, sizeof(stats));
+}
+
+template <class Link, byte NbChannels, byte QueueLen, byte MaxDataLen>
+void RFGateway<Link, NbChannels, QueueLen, MaxDataLen>::set_link(
+           byte channel, Link* link) {
+    if (channel < NbChannels)
+        links[channel] = link;
+}
+
+template <class Link, byte NbChannels, byte QueueLen, byte MaxDataLen>
+Link* RFGateway<Link, NbChannels, QueueLen, MaxDataLen>::get_link(
+           byte channel) const {
+    return channel < NbChannels ? links[channel] : nullptr;
+}
+
+template <class Link, byte NbChannels, byte QueueLen, byte MaxDataLen>
+byte RFGateway<Link, NbChannels, QueueLen, MaxDataLen>::get_channel(
+           address_t node) const {
+    byte b = node_channels[node >> 1];
+    return (node & 1) ? (b >> 4) : (b & 0x0F);
+}
+
+template <class Link, byte NbChannels, byte QueueLen, byte MaxDataLen>
+void RFGateway<Link, NbChannels, QueueLen, MaxDataLen>::set_channel(
+           address_t node, byte channel) {
+    byte old = get_channel(node);
+    if (old == channel)
+        return;
+    if (old != CHANNEL_NONE)
+        stats[old].nodes--;
+    if (channel != CHANNEL_NONE)
+        stats[channel].nodes++;
+
+    byte* b = &node_channels[node >> 1];
+    if (node & 1)
+        *b = (*b & 0x0F) | (channel << 4);
+    else
+        *b = (*b & 0xF0) | channel;
+}
+
+// channel can be CHANNEL_NONE, to unassign node.
+// Note the gateway does not tell the node: how a node learns its channel is
+// up to the application.
+template <class Link, byte NbChannels, byte QueueLen, byte MaxDataLen>
+void RFGateway<Link, NbChannels, QueueLen, MaxDataLen>::assign(
+           address_t node, byte channel) {
+    if (node == ADDR_BROADCAST)
+        return;
+    if (channel >= NbChannels)
+        channel = CHANNEL_NONE;
+    set_channel(node, channel);
+}
+
+// Assign node to the channel that has the least nodes (and, among them, that
+// received the least packets), to spread load.
+// Returns the channel.
+template <class Link, byte NbChannels, byte QueueLen, byte MaxDataLen>
+byte RFGateway<Link, NbChannels, QueueLen, MaxDataLen>::assign_auto(
+           address_t node) {
+    set_channel(node, CHANNEL_NONE);
+
+    byte best = 0;
+    for (byte c = 1; c < NbChannels; ++c) {
+        if (stats[c].nodes < stats[best].nodes
+            || (stats[c].nodes == stats[best].nodes
+                && stats[c].rx_pkts < stats[best].rx_pkts)) {
+            best = c;
+        }
+    }
+    assign(node, best);
+    return best;
+}
+
+// Keep one receive task underway per link, and move data received into the
+// queue.
+// When the queue is full, data is left inside the link (and not
+// acknowledged) until there's room. Link discards it after
+// DEFAULT_RECEIVE_DATA_AVAIL_DELAY.
+template <class Link, byte NbChannels, byte QueueLen, byte MaxDataLen>
+void RFGateway<Link, NbChannels, QueueLen, MaxDataLen>::poll_link(
+           byte channel) {
+    Link* link = links[channel];
+    taskid_t* taskid = &rcv_taskids[channel];
+
+    if (*taskid != TASKID_NONE) {
+        byte st = link->task_get_status(*taskid);
+        if (st == ST_RECEIVE)
+            return;
+
+        if (st == ST_RECEIVE_DATA_AVAILABLE) {
+            if (queue_count >= QueueLen)
+                return;
+
+            RcvdPkt* pkt = &queue[(queue_head + queue_count) % QueueLen];
+            link->receive_get_data(*taskid, pkt->data, sizeof(pkt->data),
+                                   &pkt->len, &pkt->sender, &pkt->rxinfo);
+            pkt->channel = channel;
+            queue_count++;
+
+            stats[channel].rx_pkts++;
+            stats[channel].rx_bytes += pkt->len;
+            if (get_channel(pkt->sender) == CHANNEL_NONE)
+                set_channel(pkt->sender, channel);
+        }
+        *taskid = TASKID_NONE;
+    }
+
+    if (link->receive_noblock(taskid) != ERR_TASK_CREATED_OK)
+        *taskid = TASKID_NONE;
+}
+
+template <class Link, byte NbChannels, byte QueueLen, byte MaxDataLen>
+void RFGateway<Link, NbChannels, QueueLen, MaxDataLen>::do_events() {
+    for (byte c = 0; c < NbChannels; ++c) {
+        if (!links[c])
+            continue;
+        links[c]->do_events();
+        poll_link(c);
+    }
+}
+
+// Links are all kept running while sending.
+//
+// IMPORTANT
+//   As it runs do_events() until sending is done, it must not be called from
+//   code that do_events() reaches, such as a receive callback
+//   (RFConfig::rxcallback) of one of the links: the link would be re-entered
+//   in the middle of its processing. The same goes for receive().
+template <class Link, byte NbChannels, byte QueueLen, byte MaxDataLen>
+byte RFGateway<Link, NbChannels, QueueLen, MaxDataLen>::send(
+           address_t dst, const void* data, byte len, bool ack,
+           byte *nbsend) {
+    if (!len)
+        data = nullptr;
+
+    byte first = 0;
+    byte last = 0;
+    if (dst == ADDR_BROADCAST) {
+        last = NbChannels - 1;
+    } else {
+        first = get_channel(dst);
+        if (first == CHANNEL_NONE)
+            first = 0;
+        last = first;
+    }
+
+    byte ret = ERR_OK;
+    for (byte c = first; c <= last; ++c) {
+        if (!links[c])
+            continue;
+
+        taskid_t taskid;
+        byte r = links[c]->send_noblock(&taskid, dst, data, len, ack);
+        if (r == ERR_TASK_CREATED_OK) {
+            while (links[c]->task_get_status(taskid) == ST_SEND)
+                do_events();
+            r = links[c]->send_get_final_status(taskid, nbsend);
+        }
+
+        stats[c].tx_pkts++;
+        if (r != ERR_OK) {
+            stats[c].tx_errors++;
+            if (ret == ERR_OK)
+                ret = r;
+        }
+    }
+
+    return ret;
+}
+
+template <class Link, byte NbChannels, byte QueueLen, byte MaxDataLen>
+byte RFGateway<Link, NbChannels, QueueLen, MaxDataLen>::available() const {
+    return queue_count;
+}
+
+// Wait for a packet received on any channel.
+template <class Link, byte NbChannels, byte QueueLen, byte MaxDataLen>
+byte RFGateway<Link, NbChannels, QueueLen, MaxDataLen>::receive(
+           void* buf, byte buf_len, byte* rec_len, address_t* sender,
+           byte* channel, RxInfo* rxinfo) {
+    while (!queue_count)
+        do_events();
+
+    const RcvdPkt* pkt = &queue[queue_head];
+    byte n = (pkt->len < buf_len ? pkt->len : buf_len);
+    memcpy(buf, pkt->data, n);
+    *rec_len = n;
+    if (sender)
+        *sender = pkt->sender;
+    if (channel)
+        *channel = pkt->channel;
+    if (rxinfo)
+        *rxinfo = pkt->rxinfo;
+
+    queue_head = (queue_head + 1) % QueueLen;
+    queue_count--;
+
+    return ERR_OK;
+}
+
+template <class Link, byte NbChannels, byte QueueLen, byte MaxDataLen>
+void RFGateway<Link, NbChannels, QueueLen, MaxDataLen>::get_stats(
+           byte channel, RFChannelStats* st) const {
+    if (channel >= NbChannels)
+        return;
+    *st = stats[channel];
+#ifdef RFLINK_DUTY_CYCLE
+    st->airtime_used = (links[channel] ? links[channel]->get_airtime_used()
+                                       : 0);
+#endif
+}
+
+// Node counts are kept
+template <class Link, byte NbChannels, byte QueueLen, byte MaxDataLen>
+void RFGateway<Link, NbChannels, QueueLen, MaxDataLen>::reset_stats() {
+    for (byte c = 0; c < NbChannels; ++c) {
+        byte nodes = stats[c].nodes;
+        memset(&stats[c], 0, sizeof(stats[c]));
+        stats[c].nodes = nodes;
+    }
+}
+
+#endif // _RFGATEWAY_H
@@ -32,7 +32,6 @@
 */
 
 #include <Arduino.h>
-#include <avr/sleep.h>
 
 #include "rflink.h"
 
@@ -92,23 +91,13 @@ const byte snd_repack_sched_len =
 #define dbgf(...)
 #define dbgbin(a, b, c)
 
-#define ET_REG(...)
-#define ET_STRINGS(a, b)
-#define ET_PRTPERIOD(a)
-
 #else
 
 #include "debug.h"
 
 #endif
 
-#if !defined(RFLINK_DEBUG) || !defined(RFLINK_DEBUG_EVENTTIMER)
-
-#define ET_REG(...)
-#define ET_STRINGS(a, b)
-#define ET_PRTPERIOD(a)
-
-#else
+#if defined(RFLINK_DEBUG) && defined(RFLINK_DEBUG_EVENTTIMER)
 
 #ifdef RFLINK_DEBUG_EVENTTIMER_ONLY
 
@@ -121,23 +110,7 @@ const byte snd_repack_sched_len =
 
 #endif // RFLINK_DEBUG_EVENTTIMER_ONLY
 
-static EventTimer ET;
-#define ET_REG(...)      ET.ev_reg(__VA_ARGS__)
-#define ET_STRINGS(a, b) ET.ev_set_all_strings(a, b)
-#define ET_PRTPERIOD(a)  ET.ev_print_by_period(a)
-
-// Don't use zero for a real event (it is used to mark array entries as being
-// unused).
-enum {
-    EV_NONE = 0,                     // Never use it
-    EV_SEND_CALL,
-    EV_SENT_OK,
-    EV_SENT_NOTOK,
-    EV_RECEIVE_CALL,
-    EV_RECEIVED_OK,
-    EV_RECEIVED_NOTOK,
-    EV_RECEIVED_0_BYTE_RCVD
-};
+EventTimer rflink_et;
 
 // *IMPORTANT*
 // NEVER LONGER THAN EV_STRING_MAX_LENGTH
@@ -154,13 +127,114 @@ const char *const ev_string_table[] PROGMEM = {
     ev00, ev01, ev02, ev03, ev04, ev05, ev06, ev07
 };
 
-#endif // !defined(RFLINK_DEBUG) || !defined(RFLINK_DEBUG_EVENTTIMER);
+void rflink_et_strings() {
+    rflink_et.ev_set_all_strings(ev_string_table,
+      sizeof(ev_string_table) / sizeof(*ev_string_table));
+}
+
+#endif // defined(RFLINK_DEBUG) && defined(RFLINK_DEBUG_EVENTTIMER)
+
+// Device interrupt handlers take no argument: each link instance is given
+// one of the trampolines below, that sets the interrupted flag of the
+// instance.
+static_assert(RFLINK_MAX_INSTANCES >= 1 && RFLINK_MAX_INSTANCES <= 4,
+  "RFLINK_MAX_INSTANCES must be between 1 and 4");
+
+static volatile bool* isr_flags[RFLINK_MAX_INSTANCES];
+
+template <byte N> static void isr_trampoline() {
+    *isr_flags[N] = true;
+}
+
+static const isr_func_t isr_table[] = {
+    isr_trampoline<0>,
+#if RFLINK_MAX_INSTANCES >= 2
+    isr_trampoline<1>,
+#endif
+#if RFLINK_MAX_INSTANCES >= 3
+    isr_trampoline<2>,
+#endif
+#if RFLINK_MAX_INSTANCES >= 4
+    isr_trampoline<3>,
+#endif
+};
+
+// Return the interrupt handler that sets *flag, nullptr if none is left
+isr_func_t rflink_isr_attach(volatile bool* flag) {
+    for (byte i = 0; i < RFLINK_MAX_INSTANCES; ++i) {
+        if (!isr_flags[i]) {
+            isr_flags[i] = flag;
+            return isr_table[i];
+        }
+    }
+    return nullptr;
+}
+
+void rflink_isr_detach(isr_func_t func) {
+    for (byte i = 0; i < RFLINK_MAX_INSTANCES; ++i) {
+        if (isr_table[i] == func)
+            isr_flags[i] = nullptr;
+    }
+}
+
+#ifdef RFLINK_WDT_SLEEP
+
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+
+static volatile bool wdt_fired = false;
+
+ISR(WDT_vect) {
+    wdt_fired = true;
+}
+
+// Sleep (sleep mode is expected to be set already) for d milliseconds, by
+// watchdog periods (16 ms to 8 s) no longer than max_period, or until
+// *wake_flag is set.
+// Returns the time slept. A period interrupted by another source than the
+// watchdog is not counted, as how long CPU slept is unknown.
+mtime_t rflink_wdt_sleep(mtime_t d, mtime_t max_period,
+                         volatile bool* wake_flag) {
+    mtime_t slept = 0;
+    if (max_period > d)
+        max_period = d;
+
+    while (d >= 16) {
+        // Watchdog period is 16 ms << prescaler, prescaler going up to 9
+        byte p = 0;
+        while (p < 9 && ((mtime_t)16 << (p + 1)) <= max_period)
+            ++p;
+        mtime_t period = (mtime_t)16 << p;
+
+        noInterrupts();
+        if (*wake_flag) {
+            interrupts();
+            break;
+        }
+        wdt_fired = false;
+        wdt_reset();
+        MCUSR &= ~(1 << WDRF);
+        WDTCSR = (1 << WDCE) | (1 << WDE);
+        WDTCSR = (1 << WDIE) | ((p & 8) ? (1 << WDP3) : 0) | (p & 7);
+        interrupts();
+        sleep_cpu();
+        wdt_disable();
+
+        if (!wdt_fired)
+            break;
+
+        slept += period;
+        d -= period;
+        if (max_period > d)
+            max_period = d;
+    }
 
-static bool interrupted = false;
-static void interrupt_func() {
-    interrupted = true;
+    return slept;
 }
 
+#endif // RFLINK_WDT_SLEEP
+
 #ifdef ERR_STRINGS
 
 #define ERR_STRING_MAX_LENGTH 50
@@ -194,10 +268,14 @@ const char er11[] PROGMEM = "undefined (no return code available)";
 const char er12[] PROGMEM = "task is underway";
 // ERR_TIMEOUT
 const char er13[] PROGMEM = "timeout";
+// ERR_DUTY_CYCLE_EXCEEDED
+const char er14[] PROGMEM = "duty cycle budget exceeded";
+// ERR_SEND_IN_PROGRESS
+const char er15[] PROGMEM = "send in progress";
 
 const char *const err_string_table[] PROGMEM = {
     er00, er01, er02, er03, er04, er05, er06, er07, er08, er09, er10, er11,
-    er12, er13
+    er12, er13, er14, er15
 };
 
 #define ERR_STRING_TABLE_LEN \
@@ -211,262 +289,7 @@ const char err_string_buffer[] = "error strings not available";
 
 #endif // ERR_STRINGS
 
-static inline mtime_t get_current_time() {
-    return millis();
-}
-
-static uint8_t to_flags(byte seq, byte opt) {
-    return ((seq & 0x0F) << 4) | (opt & 0x0F);
-}
-
-static void from_flags(byte flags, byte* seq, byte* opt) {
-    *opt = (flags & 0x0F);
-    *seq = flags >> 4;
-}
-
-
-//
-// RFConfig
-//
-
-RFConfig::RFConfig():
-    deferred_exec_func(nullptr),
-    deferred_exec_pdata(nullptr),
-    def_sender(0),
-    def_timeout(0),
-    def_rxcallback(0),
-    sender(0),
-    timeout(0),
-    rxcallback(nullptr) {
-
-}
-
-
-//
-// Tasks
-//
-
-void RFLink::task_destroy(Task* tsk_to_destroy) {
-    if (!pre_allocate) {
-#ifndef ENFORCE_MAX_TASK_COUNT_AT_COMPILE_TIME
-        if (tsk_to_destroy == tskhead) {
-            tskhead = tsk_to_destroy->next;
-        } else {
-            Task* tsk = tskhead;
-            Task* previous_tsk = tsk;
-            while (tsk != tsk_to_destroy && tsk != nullptr) {
-                previous_tsk = tsk;
-                tsk = tsk->next;
-            }
-            assert(tsk);
-            previous_tsk->next = tsk_to_destroy->next;
-        }
-
-        task_reset(tsk_to_destroy);
-        delete tsk_to_destroy;
-#endif
-    } else {
-        tsk_to_destroy->pktkeeper.release_data();
-        task_reset(tsk_to_destroy);
-    }
-
-    --task_count;
-}
-
-void RFLink::task_reset(Task* tsk) {
-    tsk->taskid = 0;
-    tsk->status = ST_NOTHING;
-    tsk->evtsub_wakeup = 0;
-    tsk->evtsub_pktrcvd = 0;
-    tsk->last_retcode = ERR_UNDEFINED;
-    tsk->to_execute = 0;
-    tsk->to_destroy = 0;
-
-    if (tsk->cfg) {
-        delete tsk->cfg;
-        tsk->cfg = nullptr;
-    }
-}
-
-Task* RFLink::task_create(byte status) {
-    if (task_count >= max_task_count)
-        return nullptr;
-
-    Task* tsk;
-
-    if (!pre_allocate) {
-
-#ifndef ENFORCE_MAX_TASK_COUNT_AT_COMPILE_TIME
-        tsk = new Task;
-        if (!tsk)
-            return nullptr;
-
-        if (!tskhead) {
-            tskhead = tsk;
-        } else {
-            Task* tskwalker = tskhead;
-            Task* previous_tskwalker = tskwalker;
-            while (tskwalker != nullptr) {
-                previous_tskwalker = tskwalker;
-                tskwalker = tskwalker->next;
-            }
-            assert(!previous_tskwalker->next);
-            previous_tskwalker->next = tsk;
-        }
-        tsk->next = nullptr;
-#endif
-
-    } else {
-
-        tsk = tskhead;
-        while (tsk != nullptr && tsk->status != ST_NOTHING)
-            tsk = tsk->next;
-        if (!tsk)
-            return nullptr;
-
-    }
-
-    tsk->cfg = nullptr;
-    task_reset(tsk);
-
-    ++last_taskid;
-    if (last_taskid == TASKID_NONE)
-        ++last_taskid;
-    tsk->taskid = last_taskid;
-    tsk->status = status;
-    tsk->mtime_ref = get_current_time();
-
-    tsk->is_an_ack = 0;
-    tsk->need_ack = 0;
-    tsk->has_received_ack = 0;
-    tsk->unattended = 0;
-
-    tsk->nbsend = 0;
-
-    ++task_count;
-
-    return tsk;
-}
-
-//
-// RFLink
-//
-
-RFLinkFunctions::RFLinkFunctions():
-    deviceInit(nullptr),
-    deviceSend(nullptr),
-    deviceReceive(nullptr),
-    deviceSetOpt(nullptr),
-    setInterrupt(nullptr),
-    resetInterrupt(nullptr) {
-
-}
-
-RFLink::RFLink(byte maxtask, unsigned char prealloc):
-      max_payload_len(0),
-      interrupt_is_attached(0),
-      device_addr_has_been_defined(0),
-      pre_allocate(prealloc),
-      auto_sleep(0),
-      device_addr(0x00),
-      last_pktid(0),
-      last_taskid(TASKID_NONE),
-      receive_data_avail_delay(DEFAULT_RECEIVE_DATA_AVAIL_DELAY),
-      receive_purge_delay(DEFAULT_RECEIVE_PURGE_DELAY),
-      send_purge_delay(DEFAULT_SEND_PURGE_DELAY),
-      last_device_reset(0),
-      recpkt(nullptr),
-      task_count(0),
-      max_task_count(maxtask)
-#ifndef ENFORCE_MAX_TASK_COUNT_AT_COMPILE_TIME
-      ,tskhead(nullptr)
-#endif
-{
-
-    for (byte i = 0; i < PKTID_CACHE_SIZE; ++i) {
-        cache_pktids[i].used = false;
-    }
-
-#if defined(RFLINK_DEBUG) && defined(RFLINK_DEBUG_EVENTTIMER)
-    ET_STRINGS(ev_string_table,
-      sizeof(ev_string_table) / sizeof(*ev_string_table));
-#endif
-
-#ifdef ENFORCE_MAX_TASK_COUNT_AT_COMPILE_TIME
-    maxtask = DEFAULT_MAX_TASK_COUNT;
-    pre_allocate = 1;
-#else
-    if (!maxtask)
-        maxtask = DEFAULT_MAX_TASK_COUNT;
-#endif
-
-    if (pre_allocate) {
-
-        dbg("PREALLOCATE = 1");
-
-#ifndef ENFORCE_MAX_TASK_COUNT_AT_COMPILE_TIME
-        // Defensive programming
-        assert(tskhead == nullptr);
-        // Defensive programming
-        assert(max_task_count >= 1);
-
-        tskhead = new Task[max_task_count];
-#endif
-
-        for (byte i = 0; i < max_task_count; ++i) {
-            tskhead[i].next =
-              (i < max_task_count - 1) ? &tskhead[i + 1] : nullptr;
-            task_reset(&tskhead[i]);
-        }
-    } else {
-        dbg("preallocate = 0");
-    }
-}
-
-RFLink::~RFLink() {
-    if (recpkt)
-        delete recpkt;
-
-    if (!pre_allocate) {
-        while (tskhead)
-            task_destroy(tskhead);
-    } else {
-#ifndef ENFORCE_MAX_TASK_COUNT_AT_COMPILE_TIME
-        for (Task* tsk = tskhead; tsk != nullptr; tsk = tsk->next) {
-            task_destroy(tsk);
-        }
-        delete []tskhead;
-#endif
-    }
-}
-
-void RFLink::register_funcs(const RFLinkFunctions* arg_funcs) {
-    funcs = *arg_funcs;
-
-    if (!funcs.deviceInit)
-        return;
-
-    byte max_data_len;
-    (*funcs.deviceInit)(&max_data_len, false);
-    max_payload_len = max_data_len - sizeof(Header);
-
-    if (pre_allocate)
-        initialize_recpkt_if_necessary();
-}
-
-byte RFLink::get_header_len() {
-    return sizeof(Header);
-}
-
-byte RFLink::get_pkt_max_size() const {
-    return sizeof(Header) + max_payload_len;
-}
-
-byte RFLink::get_max_payload_len() const {
-    return max_payload_len;
-}
-
-const char* RFLink::get_err_string(byte errcode) const {
+const char* rflink_get_err_string(byte errcode) {
 
 #ifdef ERR_STRINGS
     if (errcode < ERR_STRING_TABLE_LEN) {
@@ -480,864 +303,297 @@ const char* RFLink::get_err_string(byte errcode) const {
     return err_string_buffer;
 }
 
-void RFLink::initialize_recpkt_if_necessary() {
-    if (!recpkt) {
-        dbg("********** INITIALIZED RECPKT");
-        recpkt = new PktKeeper(get_pkt_max_size());
-    }
-}
-
-byte RFLink::tev_received(Task* tsk, PktKeeper* pk,
-                          bool pktid_already_seen, bool* pkt_consumed) {
-    assert(!*pkt_consumed);
-
-    Header hbackup = (*pk->get_header_ptr());
-    byte ret = tsk->status;
-
-    byte seq;
-    byte opt;
-    from_flags(pk->get_flags(), &seq, &opt);
-
-    if (opt & FLAG_ACK) {
-        if ((tsk->status == ST_SEND || tsk->status == ST_SEND_DONE)) {
-            if (tsk->need_ack && !tsk->has_received_ack) {
-                if (tsk->pktkeeper.get_header_ptr()->pktid
-                      == pk->get_header_ptr()->pktid) {
-
-#ifndef DEBUG_KEEP_SENDING_EVEN_AFTER_RECEIVING_ACK
-                    tsk->has_received_ack = 1;
-
-                    if (tsk->status == ST_SEND) {
-                        tsk->mtime_wakeup =
-                          get_current_time() + send_purge_delay;
-                        ret = ST_SEND_DONE;
-                    }
-
-                    // We received ACK: we therefore don't need to keep whole
-                    // packet any longer.
-                    tsk->pktkeeper.reduce_packet_to_its_header();
-
-                    *pkt_consumed = true;
-#endif
-
-                }
-            }
-        }
-        return ret;
-    }
-
-    if (tsk->status == ST_RECEIVE && !pktid_already_seen) {
-
-        tsk->pktkeeper.copy_packet(pk);
-        tsk->last_retcode = ERR_OK;
-        *pkt_consumed = true;
-        ret = ST_RECEIVE_DATA_AVAILABLE;
-        tsk->evtsub_wakeup = 1;
-        tsk->mtime_ref = get_current_time();
-        tsk->mtime_wakeup = tsk->mtime_ref + receive_data_avail_delay;
-
-    } else if (tsk->status == ST_RECEIVE_DATA_AVAILABLE
-               || tsk->status == ST_RECEIVE_DATA_RETRIEVED) {
-
-        if (tsk->pktkeeper.get_header_ptr()->pktid == hbackup.pktid
-            && tsk->pktkeeper.get_header_ptr()->src == hbackup.src) {
-            *pkt_consumed = true;
-
-            if (tsk->status == ST_RECEIVE_DATA_RETRIEVED) {
-                send_ack(tsk);
-            }
-
-        }
-    }
-
-    return ret;
-}
-
-byte RFLink::tev_wakeup(Task* tsk) {
-
-    if (tsk->status == ST_SEND) {
-        if (!tsk->need_ack
-             || tsk->send_schedule_pos < tsk->nb_send_schedules - 1) {
-            tsk->nbsend++;
-            ET_REG(EV_SEND_CALL);
-            byte r = (*funcs.deviceSend)(
-                       tsk->pktkeeper.get_pkt_ptr_ro(),
-                       tsk->pktkeeper.get_pkt_len()
-                     );
-
-            tsk->last_retcode = r;
-
-#ifdef RFLINK_DEBUG
-
-#ifndef RFLINK_DEBUG_EVENTTIMER_ONLY
-            const Header* h = tsk->pktkeeper.get_header_ptr();
+// On-air format of header.
+// Fields are written one by one, multi-byte fields in little-endian order, so
+// that the format is the same whatever the target (AVR, ARM, ...).
+//
+// Standard format:
+//   byte 0: dst
+//   byte 1: src
+//   byte 2: flags
+//   byte 3: pktid, low byte
+//   byte 4: pktid, high byte
+//   byte 5: len
+// This is the in-memory layout of Header on AVR, therefore devices running
+// older versions (that were sending Header as is) remain compatible.
+//
+// Compact format (RFLINK_COMPACT_HEADER defined):
+//   byte 0: dst
+//   byte 1: src
+//   byte 2: flags
+//   byte 3: pktid
+//   len is not sent, it is deduced from the packet length.
+
+#ifdef RFLINK_COMPACT_HEADER
+static_assert(sizeof(pktid_t) == 1 && WIRE_HEADER_LEN == 4,
+  "compact header layout: pktid is expected to be 1-byte");
+#else
+static_assert(sizeof(pktid_t) == 2 && WIRE_HEADER_LEN == 6,
+  "standard header layout: pktid is expected to be 2-byte");
 #endif
-            if (r) {
-                ET_REG(EV_SENT_NOTOK);
-
-#ifndef RFLINK_DEBUG_EVENTTIMER_ONLY
-                dbgf("send err: taskid=%u, s=0x%02x, d=0x%02x, fl=0x%02x"
-                     ", pktid=0x%04x, len=%i, err=%i: %s",
-                     tsk->taskid, h->src, h->dst, h->flags, h->pktid, h->len,
-                     r, get_err_string(r));
+static_assert(sizeof(address_t) == 1 && sizeof(((Header*)0)->flags) == 1
+              && sizeof(((Header*)0)->len) == 1,
+  "header layout: dst, src, flags and len are expected to be 1-byte");
+
+static void header_encode(const Header* h, byte* wire) {
+    wire[0] = h->dst;
+    wire[1] = h->src;
+    wire[2] = h->flags;
+#ifdef RFLINK_COMPACT_HEADER
+    wire[3] = h->pktid;
+#else
+    wire[3] = (byte)h->pktid;
+    wire[4] = (byte)(h->pktid >> 8);
+    wire[5] = h->len;
 #endif
+}
 
-            } else {
-                ET_REG(EV_SENT_OK);
-
-#ifndef RFLINK_DEBUG_EVENTTIMER_ONLY
-                dbgf("send ok:  taskid=%u, s=0x%02x, d=0x%02x, fl=0x%02x"
-                     ", pktid=0x%04x, len=%i", tsk->taskid,
-                     h->src, h->dst, h->flags, h->pktid, h->len);
+static void header_decode(const byte* wire, byte pkt_len, Header* h) {
+    h->dst = wire[0];
+    h->src = wire[1];
+    h->flags = wire[2];
+#ifdef RFLINK_COMPACT_HEADER
+    h->pktid = wire[3];
+    h->len = pkt_len - WIRE_HEADER_LEN;
+#else
+    (void)pkt_len;
+    h->pktid = (pktid_t)wire[3] | ((pktid_t)wire[4] << 8);
+    h->len = wire[5];
 #endif
+}
 
-            }
-#endif // RFLINK_DEBUG
-
-            byte seq;
-            byte opts;
-            from_flags(tsk->pktkeeper.get_flags(), &seq, &opts);
-
-            if (!tsk->is_an_ack)
-                ++seq;
-
-            tsk->pktkeeper.set_flags(to_flags(seq, tsk->pktkeeper.get_flags()));
-        }
-
-        tsk->send_schedule_pos++;
-
-        if (tsk->send_schedule_pos < tsk->nb_send_schedules) {
-            tsk->mtime_wakeup =
-              tsk->mtime_ref + tsk->send_schedule_ptr[tsk->send_schedule_pos];
-        } else {
 
-            if (tsk->unattended)
-                tsk->mtime_wakeup = get_current_time();
-            else
-                tsk->mtime_wakeup = get_current_time() + send_purge_delay;
+//
+// FEC
+//
 
-            return ST_SEND_DONE;
+// Forward error correction (see RFLink::set_fec()): each nibble is sent as an
+// extended Hamming(8,4) codeword, that corrects one bit error and detects two.
+// The low nibble of a byte is sent first.
+// Codewords are interleaved by groups of 8 (the 8 x 8 bit matrix of a group is
+// transposed), so that an error burst of up to 8 bits makes one bit error per
+// codeword. Codewords of the last, incomplete group, are sent as is.
+// The first clear_len bytes (destination address) are sent in clear, for the
+// device to filter on it as usual. They are covered by a CRC-8
+// (polynomial 0x07) of the whole, that follows data and is encoded the same
+// way: a codeword with three bit errors or more can be miscorrected, the CRC
+// catches it, as well as an error in the clear part.
+
+static const byte fec_enc_table[16] PROGMEM = {
+    0x00, 0x87, 0x99, 0x1e, 0xaa, 0x2d, 0x33, 0xb4,
+    0x4b, 0xcc, 0xd2, 0x55, 0xe1, 0x66, 0x78, 0xff
+};
 
-        }
+// Nibble of a codeword, ORed with FEC_CORRECTED if one bit got corrected, or
+// FEC_BAD if the codeword is not correctable.
+#define FEC_CORRECTED 0x10
+#define FEC_BAD       0x20
+static const byte fec_dec_table[256] PROGMEM = {
+    0x00, 0x10, 0x10, 0x20, 0x10, 0x20, 0x20, 0x11,
+    0x10, 0x20, 0x20, 0x18, 0x20, 0x15, 0x13, 0x20,
+    0x10, 0x20, 0x20, 0x16, 0x20, 0x1b, 0x13, 0x20,
+    0x20, 0x12, 0x13, 0x20, 0x13, 0x20, 0x03, 0x13,
+    0x10, 0x20, 0x20, 0x16, 0x20, 0x15, 0x1d, 0x20,
+    0x20, 0x15, 0x14, 0x20, 0x15, 0x05, 0x20, 0x15,
+    0x20, 0x16, 0x16, 0x06, 0x17, 0x20, 0x20, 0x16,
+    0x1e, 0x20, 0x20, 0x16, 0x20, 0x15, 0x13, 0x20,
+    0x10, 0x20, 0x20, 0x18, 0x20, 0x1b, 0x1d, 0x20,
+    0x20, 0x18, 0x18, 0x08, 0x19, 0x20, 0x20, 0x18,
+    0x20, 0x1b, 0x1a, 0x20, 0x1b, 0x0b, 0x20, 0x1b,
+    0x1e, 0x20, 0x20, 0x18, 0x20, 0x1b, 0x13, 0x20,
+    0x20, 0x1c, 0x1d, 0x20, 0x1d, 0x20, 0x0d, 0x1d,
+    0x1e, 0x20, 0x20, 0x18, 0x20, 0x15, 0x1d, 0x20,
+    0x1e, 0x20, 0x20, 0x16, 0x20, 0x1b, 0x1d, 0x20,
+    0x0e, 0x1e, 0x1e, 0x20, 0x1e, 0x20, 0x20, 0x1f,
+    0x10, 0x20, 0x20, 0x11, 0x20, 0x11, 0x11, 0x01,
+    0x20, 0x12, 0x14, 0x20, 0x19, 0x20, 0x20, 0x11,
+    0x20, 0x12, 0x1a, 0x20, 0x17, 0x20, 0x20, 0x11,
+    0x12, 0x02, 0x20, 0x12, 0x20, 0x12, 0x13, 0x20,
+    0x20, 0x1c, 0x14, 0x20, 0x17, 0x20, 0x20, 0x11,
+    0x14, 0x20, 0x04, 0x14, 0x20, 0x15, 0x14, 0x20,
+    0x17, 0x20, 0x20, 0x16, 0x07, 0x17, 0x17, 0x20,
+    0x20, 0x12, 0x14, 0x20, 0x17, 0x20, 0x20, 0x1f,
+    0x20, 0x1c, 0x1a, 0x20, 0x19, 0x20, 0x20, 0x11,
+    0x19, 0x20, 0x20, 0x18, 0x09, 0x19, 0x19, 0x20,
+    0x1a, 0x20, 0x0a, 0x1a, 0x20, 0x1b, 0x1a, 0x20,
+    0x20, 0x12, 0x1a, 0x20, 0x19, 0x20, 0x20, 0x1f,
+    0x1c, 0x0c, 0x20, 0x1c, 0x20, 0x1c, 0x1d, 0x20,
+    0x20, 0x1c, 0x14, 0x20, 0x19, 0x20, 0x20, 0x1f,
+    0x20, 0x1c, 0x1a, 0x20, 0x17, 0x20, 0x20, 0x1f,
+    0x1e, 0x20, 0x20, 0x1f, 0x20, 0x1f, 0x1f, 0x0f
+};
 
-        return tsk->status;
-    } else if (tsk->status == ST_SEND_DONE) {
-        return ST_FINISHED;
-    } else if (tsk->status == ST_RECEIVE_DATA_RETRIEVED
-                 || tsk->status == ST_RECEIVE_TIMEDOUT) {
-        return ST_FINISHED;
-    } else if (tsk->status == ST_RECEIVE_DATA_AVAILABLE) {
-        data_retrieved_post(tsk);
-        return ST_RECEIVE_TIMEDOUT;
-    } else if (tsk->status == ST_RECEIVE) {
-        tsk->evtsub_wakeup = 1;
-        tsk->mtime_wakeup = tsk->mtime_ref + DEFAULT_RECEIVE_TIMEOUT_DELAY;
-        return ST_RECEIVE_TIMEDOUT;
-    } else if (tsk->status == ST_DEFERRED_EXEC) {
-        if (tsk->cfg && tsk->cfg->deferred_exec_func) {
-            (*tsk->cfg->deferred_exec_func)(tsk->cfg->deferred_exec_pdata);
-        } else {
-            // A deferred exec task should always own a config in which
-            // deferred_exec_func is non-null.
-            assert(false);
+static void fec_transpose(const byte* in, byte* out) {
+    for (byte i = 0; i < 8; ++i) {
+        byte b = 0;
+        for (byte j = 0; j < 8; ++j) {
+            b |= ((in[j] >> i) & 1) << j;
         }
-        return ST_FINISHED;
-    } else {
-        // Execution shall never arrive here
-        assert(false);
-    }
-
-    // Never executed
-    return ST_NOTHING;
-
-}
-
-void RFLink::interrupts_on() {
-    if (!interrupt_is_attached) {
-        interrupt_is_attached = 1;
-        (*funcs.setInterrupt)(interrupt_func);
-//        dbg("enabled interrupts");
+        out[i] = b;
     }
 }
 
-void RFLink::interrupts_off() {
-    if (interrupt_is_attached) {
-        interrupt_is_attached = 0;
-        (*funcs.resetInterrupt)();
-//        dbg("disabled interrupts");
-    }
+static byte fec_crc8(byte crc, byte b) {
+    crc ^= b;
+    for (byte i = 0; i < 8; ++i)
+        crc = (crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1);
+    return crc;
 }
 
-// FIXME
-//   Timing management won't work with auto_sleep() enabled, during periods
-//   where CPU sleeps.
-//   Not a very big issue though...
-bool RFLink::check_pktid_already_seen(address_t src, pktid_t pktid) {
-
-    bool src_found = false;
-
-    int unused_entry_idx = -1;
-    int oldest_entry_idx = -1;
-    mtime_t biggest_elapsed_found = 0;
-    mtime_t tref = get_current_time();
-
-    bool ret = false;
-
-    for (int i = 0; (unsigned)i < PKTID_CACHE_SIZE; ++i) {
-
-        cache_pktid_t* current = &cache_pktids[i];
-
-        mtime_t elapsed = tref - current->mtime;
+// out must be clear_len + 2 * (len - clear_len + FEC_CRC_LEN) long
+void rflink_fec_encode(const void* data, byte len, byte clear_len, byte* out) {
+    const byte* in = (const byte*)data;
+    byte crc = 0;
+    for (byte i = 0; i < len; ++i)
+        crc = fec_crc8(crc, in[i]);
 
-        if (current->used && elapsed >= CACHE_PKTID_DISCARD_DELAY) {
-//            dbgf("IDrec: discard tooold=#%i, s=0x%02x", i, current->src);
-            current->used = false;
-        }
+    for (byte i = 0; i < clear_len; ++i)
+        *out++ = in[i];
+    in += clear_len;
+    len -= clear_len;
 
-        if (!current->used) {
-            if (unused_entry_idx < 0)
-                unused_entry_idx = i;
-            continue;
+    byte cw[8];
+    byte i = 0;
+    for ( ; i + 4 <= len + 1; i += 4) {
+        for (byte j = 0; j < 4; ++j) {
+            byte b = (i + j < len ? in[i + j] : crc);
+            cw[2 * j] = pgm_read_byte(&fec_enc_table[b & 0x0F]);
+            cw[2 * j + 1] = pgm_read_byte(&fec_enc_table[b >> 4]);
         }
+        fec_transpose(cw, out);
+        out += 8;
+    }
+    for ( ; i < len + 1; ++i) {
+        byte b = (i < len ? in[i] : crc);
+        *out++ = pgm_read_byte(&fec_enc_table[b & 0x0F]);
+        *out++ = pgm_read_byte(&fec_enc_table[b >> 4]);
+    }
+}
+
+static byte fec_decode_byte(const byte* cw, byte* flags, uint16_t* corrected) {
+    byte lo = pgm_read_byte(&fec_dec_table[cw[0]]);
+    byte hi = pgm_read_byte(&fec_dec_table[cw[1]]);
+    if (lo & FEC_CORRECTED)
+        ++*corrected;
+    if (hi & FEC_CORRECTED)
+        ++*corrected;
+    *flags |= lo | hi;
+    return (lo & 0x0F) | ((hi & 0x0F) << 4);
+}
+
+// out must be clear_len + (len - clear_len) / 2 - FEC_CRC_LEN long.
+// Returns the number of bytes decoded (clear part included), or 0 if a
+// codeword is not correctable, if CRC does not match (or if the encoded part is
+// of odd length, or too short). The number of bits corrected is added to
+// *corrected.
+byte rflink_fec_decode(const byte* in, byte len, byte clear_len, void* data,
+                       uint16_t* corrected) {
+    byte* out = (byte*)data;
+    if (len < clear_len + 2 * FEC_CRC_LEN || ((len - clear_len) & 1))
+        return 0;
 
-        if (current->src == src) {
-
-            // ret being true should never happen: one entry per source
-            assert(!ret);
-
-            src_found = true;
-
-//            dbgf("IDrec: match #%i, s=0x%02x", i, src);
-            current->mtime = tref;
-            if (current->last_pktid_seen == pktid) {
-                ret = true;
+    byte crc = 0;
+    for (byte i = 0; i < clear_len; ++i) {
+        out[i] = in[i];
+        crc = fec_crc8(crc, in[i]);
+    }
+    out += clear_len;
+    in += clear_len;
+    len -= clear_len;
+
+    byte n = len / 2 - FEC_CRC_LEN;
+    byte cw[8];
+    byte flags = 0;
+    byte crc_rcvd = 0;
+    byte k = 0;
+    byte i = 0;
+    for ( ; i + 8 <= len; i += 8) {
+        fec_transpose(in + i, cw);
+        for (byte j = 0; j < 8; j += 2) {
+            byte b = fec_decode_byte(cw + j, &flags, corrected);
+            if (k < n) {
+                out[k] = b;
+                crc = fec_crc8(crc, b);
             } else {
-                current->last_pktid_seen = pktid;
+                crc_rcvd = b;
             }
-
-        } else if (elapsed > biggest_elapsed_found) {
-
-            biggest_elapsed_found = elapsed;
-            oldest_entry_idx = i;
-
-        }
-
-    }
-
-    if (!src_found) {
-        int idx = unused_entry_idx;
-        if (idx < 0) {
-            idx = oldest_entry_idx;
-//            dbgf("IDrec: erase oldest=#%i, s=0x%02x",
-//                 idx, cache_pktids[idx].src);
-        } else {
-//            dbgf("IDrec: will use empty slot #%i", idx);
-        }
-
-        cache_pktids[idx].used = true;
-        cache_pktids[idx].src = src;
-        cache_pktids[idx].mtime = tref;
-        cache_pktids[idx].last_pktid_seen = pktid;
-    }
-
-    return ret;
-}
-
-// * NOTE ABOUT 'to_execute' ATTRIBUTE *
-// It is used to 'freeze' the task list to execute at the beginning of
-// do_events().
-// That is, tasks created along the way of do_events execution WILL NOT be
-// executed during the same loop - when created, the to_execute attribute is set
-// to 0. Only at the end of do_events do we set this attribute for all tasks,
-// that means, the tasks created will later be executed normally.
-// This mechanism is meant as a safeguard against reentrant calls.
-void RFLink::do_events() {
-
-    if (!funcs.deviceInit)
-        return;
-
-    bool i_want_to_receive = false;
-    for (Task* tsk = tskhead; tsk != nullptr; tsk = tsk->next) {
-        if (tsk->evtsub_pktrcvd) {
-            i_want_to_receive = true;
-            break;
-        }
-    }
-    if (!funcs.deviceReceive)
-        i_want_to_receive = false;
-
-    if (i_want_to_receive)
-        interrupts_on();
-
-    // If true, pkt contains a packet that we want to hand over to a task
-    bool got_a_pkt = false;
-
-    unsigned long int zzz000 = micros();
-    (void)zzz000;
-
-    if (interrupted) {
-        interrupts_off();
-
-#if defined(RFLINK_DEBUG) && defined(RFLINK_DEBUG_EVENTTIMER_ONLY)
-        mtime_t t0 = get_current_time();
-#endif
-
-        byte nb_bytes_rcvd = 0;
-        if (i_want_to_receive) {
-            initialize_recpkt_if_necessary();
-
-            // FIXME
-            // Writing directly into PktKeeper' packet is not good practice.
-            // Doing it in a clean way will be a bit overkill (imho).
-            nb_bytes_rcvd =
-              (*funcs.deviceReceive)(
-                 recpkt->notrecommended_get_pkt_ptr(), get_pkt_max_size()
-              );
-
-            got_a_pkt = recpkt->check_rcvd_pkt_is_ok(this, nb_bytes_rcvd);
-        }
-
-#ifdef RFLINK_DEBUG
-#ifndef RFLINK_DEBUG_EVENTTIMER_ONLY
-        const Header* h = recpkt->get_header_ptr();
-#endif
-        if (got_a_pkt) {
-            ET_REG(EV_RECEIVE_CALL, t0);
-            ET_REG(EV_RECEIVED_OK);
-            dbgf("incoming pkt:       s=0x%02x, d=0x%02x, fl=0x%02x"
-                   ", pktid=0x%04x, len=%i",
-                   h->src, h->dst, h->flags, h->pktid, h->len);
-        } else if (nb_bytes_rcvd >= sizeof(Header)) {
-            ET_REG(EV_RECEIVE_CALL, t0);
-            ET_REG(EV_RECEIVED_NOTOK);
-            dbgf("incoming pkt: packet of incorrect size"
-                   ", len=%i, header.len=%i",
-                   nb_bytes_rcvd, recpkt->get_data_len());
-        } else if (nb_bytes_rcvd >= 1) {
-            ET_REG(EV_RECEIVE_CALL, t0);
-            ET_REG(EV_RECEIVED_NOTOK);
-            dbgf("incoming pkt: packet of incorrect size, len=%i",
-                   nb_bytes_rcvd);
-        } else {
-            ET_REG(EV_RECEIVE_CALL, t0);
-            ET_REG(EV_RECEIVED_0_BYTE_RCVD);
-            dbg("incoming pkt: empty packet (no reception)");
+            ++k;
         }
-#endif // RFLINK_DEBUG
-
-        interrupted = false;
-        interrupts_on();
-    }
-
-    mtime_t tref = get_current_time();
-
-    bool pktid_already_seen = false;
-    if (got_a_pkt) {
-        const Header* h = recpkt->get_header_ptr();
-        pktid_already_seen = check_pktid_already_seen(h->src, h->pktid);
     }
-
-    bool device_needs_reset = false;
-
-    for (Task* tsk = tskhead; tsk != nullptr; tsk = tsk->next) {
-
-        if (!tsk->to_execute)
-            continue;
-
-        byte new_status = tsk->status;
-
-        if (tsk->evtsub_pktrcvd && got_a_pkt) {
-            bool pkt_consumed = false;
-            new_status = tev_received(tsk, recpkt, pktid_already_seen,
-              &pkt_consumed);
-            if (pkt_consumed) {
-                dbgf("incoming pkt: pkt consumed by taskid=%u, st=%i",
-                       tsk->taskid, tsk->status);
-                got_a_pkt = false;
-            }
-        }
-
-        if (tsk->evtsub_wakeup && new_status == tsk->status) {
-            // NOTE
-            // Yes, casting to "signed" works if the difference does not go
-            // beyond the type capacity (here: around 24 days).
-            long int elapsed = (long int)(tref - tsk->mtime_wakeup);
-            if (elapsed >= 0) {
-                new_status = tev_wakeup(tsk);
-            }
-        }
-
-        if (new_status != ST_RECEIVE
-              && new_status != ST_NOTHING
-              && new_status != ST_FINISHED) {
-            if (!tsk->evtsub_wakeup) {
-                dbgf("taskid:%i", tsk->taskid);
-                assert(false);
-            }
-        }
-
-        if (new_status == ST_FINISHED) {
-            if (tsk->status == ST_SEND_DONE
-                  && tsk->need_ack && !tsk->has_received_ack) {
-                device_needs_reset = true;
-            }
-            tsk->to_destroy = 1;
+    for ( ; i < len; i += 2) {
+        byte b = fec_decode_byte(in + i, &flags, corrected);
+        if (k < n) {
+            out[k] = b;
+            crc = fec_crc8(crc, b);
         } else {
-            tsk->status = new_status;
-        }
-    }
-
-    if (got_a_pkt) {
-        dbg("incoming pkt: packet not consumed");
-    }
-
-    if (device_needs_reset) {
-        mtime_t now = get_current_time();
-        if ((now - last_device_reset) >= MIN_DEVICE_RESET_DELAY) {
-            last_device_reset = now;
-            (*funcs.deviceInit)(nullptr, true);
-            delay(POST_DEVICE_RESET_DELAY);
-            dbg("did reset device");
-        }
-    }
-
-    // MANAGE "GO TO SLEEP"
-
-    //   First thing is, to work out whether or not, we are in a status that
-    //   allows to go to sleep.
-    //   The condition is: we are waiting for a packet and that's it (no other
-    //   pending task, no wake-up scheduled)
-
-    byte count_task_evtsub_pktrcvd = 0;
-    byte count_task_evtsub_wakeup = 0;
-    byte count_task_non_nothing = 0;
-    for (Task* tsk = tskhead; tsk != nullptr; tsk = tsk->next) {
-        if (tsk->evtsub_pktrcvd)
-            count_task_evtsub_pktrcvd++;
-        if (tsk->evtsub_wakeup)
-            count_task_evtsub_wakeup++;
-        else if (tsk->status != ST_NOTHING)
-            count_task_non_nothing++;
-    }
-    static bool last_is_eligible_for_sleep = false;
-    bool is_eligible_for_sleep =
-      (count_task_evtsub_pktrcvd == 1
-       && count_task_evtsub_wakeup == 0
-       && count_task_non_nothing == 1);
-
-    if (is_eligible_for_sleep && auto_sleep) {
-        sleep_enable();
-        set_sleep_mode(SLEEP_MODE_PWR_DOWN);
-        dbg("Going to sleep...");
-#ifdef RFLINK_DEBUG
-        // Needed to have data sent over the serial line, before going to sleep
-        // really.
-        delay(20);
-#endif
-
-//        noInterrupts();
-        (*funcs.deviceInit)(nullptr, true);
-//        interrupts();
-        sleep_cpu();
-
-        dbg("WAKE UP!!!");
-    } else if (is_eligible_for_sleep) {
-        if (!last_is_eligible_for_sleep) {
-            dbg("Could go to sleep, but auto_sleep is not activated");
-        }
-    }
-    last_is_eligible_for_sleep = is_eligible_for_sleep;
-
-    Task* tsknext;
-    for (Task* tsk = tskhead; tsk != nullptr; tsk = tsknext) {
-        tsknext = tsk->next;
-        if (tsk->to_destroy) {
-            task_destroy(tsk);
-        }
-    }
-
-    for (Task* tsk = tskhead; tsk != nullptr; tsk = tsk->next) {
-        if (tsk->status != ST_NOTHING && !tsk->to_execute) {
-            tsk->to_execute = 1;
-        }
-    }
-
-#ifdef RFLINK_DEBUG
-    dbg_print_status(is_eligible_for_sleep);
-#endif
-
-    ET_PRTPERIOD(10000);
-}
-
-#ifdef RFLINK_DEBUG
-void RFLink::dbg_print_status(bool is_eligible_for_sleep) {
-    static long unsigned print_status_last_t = get_current_time();
-    byte n = 0, a = 0, f = 0, r = 0;
-    for (Task* tsk = tskhead; tsk != nullptr; tsk = tsk->next) {
-        byte st = tsk->status;
-        if (st == ST_NOTHING)
-            ++n;
-        else if (st == ST_FINISHED)
-            ++f;
-        else
-            ++a;
-        if (st == ST_RECEIVE)
-            ++r;
-    }
-    long unsigned t = get_current_time();
-    if ((t - print_status_last_t) >= 500) {
-        print_status_last_t = t;
-        dbgf("do_events: N=%2i A=%2i F=%2i (R=%2i) tskc=%2i"
-               " (mpl=%i) (soT=%i) (fm=%u) (S=%i)",
-               n, a, f, r, task_count, max_payload_len, sizeof(Task),
-               freeMemory(), is_eligible_for_sleep);
-    }
-}
-#endif // RFLINK_DEBUG
-
-byte RFLink::send_ack_noblock(taskid_t* taskid, Header* h) {
-
-    assert(!h->len);
-
-    if (!funcs.deviceInit)
-        return ERR_DEVICE_NOT_REGISTERED;
-    else if (!funcs.deviceSend)
-        return ERR_SEND_FUNC_NOT_REGISTERED;
-
-    Task* tsk = task_create(ST_SEND);
-    if (!tsk) {
-        return ERR_UNABLE_TO_CREATE_TASK;
-    }
-
-    *taskid = tsk->taskid;
-
-    tsk->evtsub_wakeup = 1;
-    tsk->send_schedule_ptr = snd_repack_sched;
-    tsk->nb_send_schedules = snd_repack_sched_len;
-    tsk->send_schedule_pos = 0;
-    tsk->mtime_wakeup = tsk->mtime_ref
-                        + tsk->send_schedule_ptr[tsk->send_schedule_pos];
-
-    tsk->is_an_ack = 1;
-    tsk->unattended = 1;
-
-    tsk->pktkeeper.prepare_for_sending(this, h, nullptr);
-
-//    dbgf("send_ack_noblock: taskid=%u, s=0x%02x, d=0x%02x, fl=0x%02x"
-//           ", pktid=0x%04u, len=%i",
-//           tsk->taskid, h->src, h->dst, h->flags, h->pktid, h->len);
-
-    return ERR_TASK_CREATED_OK;
-
-}
-
-byte RFLink::send_noblock(taskid_t* taskid, address_t dst,
-                          const void* data, byte len, bool ack) {
-    if (!funcs.deviceInit)
-        return ERR_DEVICE_NOT_REGISTERED;
-    else if (!funcs.deviceSend)
-        return ERR_SEND_FUNC_NOT_REGISTERED;
-
-    if (len > max_payload_len)
-        return ERR_SEND_DATA_LEN_ABOVE_LIMIT;
-
-    // NOTE
-    // We don't test the other way round (len != 0 while data being null),
-    // this'd be not bad practice, but a pure bug. And this condition is tested
-    // by prepare_for_sending().
-    if (len == 0 && data != nullptr)
-        return ERR_SEND_BAD_ARGUMENTS;
-
-    Task* tsk = task_create(ST_SEND);
-    if (!tsk) {
-        return ERR_UNABLE_TO_CREATE_TASK;
-    }
-
-    *taskid = tsk->taskid;
-
-    tsk->evtsub_wakeup = 1;
-    tsk->nb_send_schedules = (ack ? snd_expack_sched_len : snd_sched_len);
-    tsk->send_schedule_ptr = (ack ? snd_expack_sched : snd_sched);
-    tsk->send_schedule_pos = 0;
-    tsk->mtime_wakeup = tsk->mtime_ref
-                        + tsk->send_schedule_ptr[tsk->send_schedule_pos];
-
-    if (ack) {
-        tsk->need_ack = 1;
-        tsk->evtsub_pktrcvd = 1;
-    }
-
-    Header h;
-    h.src = device_addr;
-    h.dst = dst;
-    h.flags = to_flags(0, (ack ? FLAG_SIN : FLAG_NONE));
-    h.pktid = ++last_pktid;
-    h.len = len;
-
-    tsk->pktkeeper.prepare_for_sending(this, &h, data);
-
-//    dbgf("send_noblock: taskid=%u, s=0x%02x, d=0x%02x, fl=0x%02x"
-//           ", pktid=0x%04u, len=%i",
-//           tsk->taskid, h.src, h.dst, h.flags, h.pktid, h.len);
-
-    return ERR_TASK_CREATED_OK;
-}
-
-Task* RFLink::get_task_by_taskid(taskid_t taskid) {
-    for (Task* tsk = tskhead; tsk != nullptr; tsk = tsk->next) {
-        if (tsk->taskid == taskid) {
-            return tsk;
-        }
-    }
-    return nullptr;
-}
-
-byte RFLink::task_get_status(taskid_t taskid) {
-    Task* tsk = get_task_by_taskid(taskid);
-
-    if (!tsk)
-        return ST_NOTHING;
-
-    return tsk->status;
-}
-
-byte RFLink::send_get_final_status(taskid_t taskid, byte* nbsend) {
-    Task* tsk = get_task_by_taskid(taskid);
-    if (!tsk)
-        return ERR_UNKNOWN_TASKID;
-
-    if (tsk->status != ST_SEND_DONE)
-        return ERR_TASK_UNDERWAY;
-
-    byte ret = ERR_UNDEFINED;
-
-    if (tsk->need_ack && tsk->has_received_ack) {
-        ret = ERR_OK;
-    } else if (tsk->need_ack) {
-        ret = ERR_SEND_NO_ACK_RCVD;
-    } else {
-        ret = tsk->last_retcode;
-    }
-    if (nbsend) {
-        *nbsend = tsk->nbsend;
-    }
-
-    dbgf("taskid=%u: terminating immediately", tsk->taskid);
-
-    tsk->evtsub_wakeup = 1;
-    tsk->mtime_wakeup = get_current_time();
-
-    return ret;
-}
-
-byte RFLink::send(address_t dst, const void* data, byte len, bool ack,
-                  byte *nbsend) {
-    taskid_t taskid;
-    if (!len)
-        data = nullptr;
-    byte r = send_noblock(&taskid, dst, data, len, ack);
-
-    if (r != ERR_TASK_CREATED_OK) {
-        dbgf("send: no task created, error #%i: %s", r, get_err_string(r));
-        return r;
-    }
-
-    while (task_get_status(taskid) == ST_SEND) {
-        do_events();
-    }
-
-    return send_get_final_status(taskid, nbsend);
-}
-
-byte RFLink::receive_noblock(taskid_t* taskid, RFConfig* cfg) {
-    if (!funcs.deviceInit)
-        return ERR_DEVICE_NOT_REGISTERED;
-    else if (!funcs.deviceReceive)
-        return ERR_RECEIVE_FUNC_NOT_REGISTERED;
-
-    Task* tsk = task_create(ST_RECEIVE);
-    if (!tsk) {
-        return ERR_UNABLE_TO_CREATE_TASK;
-    }
-
-    *taskid = tsk->taskid;
-    tsk->evtsub_pktrcvd = 1;
-    if (cfg) {
-        if (cfg->def_timeout) {
-            tsk->evtsub_wakeup = 1;
-            tsk->mtime_wakeup = tsk->mtime_ref + cfg->timeout;
+            crc_rcvd = b;
         }
+        ++k;
     }
 
-//    dbgf("receive_noblock: taskid=%u", tsk->taskid);
-
-    return ERR_TASK_CREATED_OK;
-}
-
-void RFLink::send_ack(Task* tsk) {
-    byte seq;
-    byte opt;
-    from_flags(tsk->pktkeeper.get_flags(), &seq, &opt);
-    if (opt & FLAG_SIN) {
-
-        const Header* h = tsk->pktkeeper.get_header_ptr();
-        Header ack_h;
-        ack_h.dst = h->src;
-        ack_h.src = device_addr;
-        ack_h.flags = to_flags(seq, FLAG_ACK);
-        ack_h.pktid = h->pktid;
-        ack_h.len = 0;
-
-        dbgf("sending back ACK for s=0x%02x, d=0x%02x, pktid=0x%04x",
-               ack_h.src, ack_h.dst, ack_h.pktid);
-
-        taskid_t taskid;
-        send_ack_noblock(&taskid, &ack_h);
-    }
-}
-
-void RFLink::data_retrieved_post(Task* tsk) {
-    tsk->pktkeeper.reduce_packet_to_its_header();
-    tsk->evtsub_wakeup = 1;
-    tsk->mtime_wakeup = tsk->mtime_ref + receive_purge_delay;
-}
-
-byte RFLink::data_retrieve(Task* tsk, void* buf, byte buf_len, byte* rec_len,
-                           address_t* sender) {
-    if (!tsk)
-        return ST_NOTHING;
-
-    if (tsk->status != ST_RECEIVE_DATA_AVAILABLE)
-        return tsk->status;
-
-    tsk->pktkeeper.copy_data(buf, buf_len, rec_len);
-    if (sender)
-        *sender = tsk->pktkeeper.get_header_ptr()->src;
-
-    data_retrieved_post(tsk);
-    tsk->status = ST_RECEIVE_DATA_RETRIEVED;
-
-    send_ack(tsk);
-
-    return tsk->status;
+    return ((flags & FEC_BAD) || crc != crc_rcvd ? 0 : clear_len + n);
 }
 
-byte RFLink::receive(void* buf, byte buf_len, byte* rec_len,
-                     address_t* sender, RFConfig* cfg) {
-    taskid_t taskid;
-    byte r = receive_noblock(&taskid, cfg);
-
-    do_events();
-
-//    dbgf("receive started, taskid = %u", taskid);
-
-    if (r != ERR_TASK_CREATED_OK) {
-//        dbgf("receive: no task created, error #%i: %s", r, get_err_string(r));
-        return r;
-    }
-
-    while (task_get_status(taskid) == ST_RECEIVE) {
-        do_events();
-    }
-
-    Task* tsk = get_task_by_taskid(taskid);
-    r = data_retrieve(tsk, buf, buf_len, rec_len, sender);
-
-    do_events();
-
-    if (r == ST_RECEIVE_DATA_AVAILABLE || r == ST_RECEIVE) {
-        assert(false);
-    } else if (r == ST_NOTHING) {
-        return ERR_TIMEOUT;
-    } else if (r == ST_RECEIVE_DATA_RETRIEVED) {
-        return ERR_OK;
-    } else if (r == ST_RECEIVE_TIMEDOUT) {
-        return ERR_TIMEOUT;
-    }
 
-    assert(false);
-
-    // Never executed
-    return ERR_UNDEFINED;
-}
+//
+// RFConfig
+//
 
-void RFLink::delay_ms(long int d) {
-    if (d <= 0)
-        return;
+RFConfig::RFConfig():
+    deferred_exec_func(nullptr),
+    deferred_exec_pdata(nullptr),
+    def_sender(0),
+    def_timeout(0),
+    def_rxcallback(0),
+    sender(0),
+    timeout(0),
+    rxcallback(nullptr) {
 
-    unsigned long int t0 = get_current_time();
-    while ((signed)(get_current_time() - t0) < d) {
-        do_events();
-    }
 }
 
 
-taskid_t RFLink::deferred_exec(mtime_t delay,
-                               void (*deferred_exec_func)(void *data),
-                               void* deferred_exec_pdata) {
-
-    // Not allowed to defer execution of nothing
-    assert(deferred_exec_func);
-
-    Task* tsk = task_create(ST_DEFERRED_EXEC);
-    if (!tsk) {
-        return TASKID_NONE;
-    }
-
-    RFConfig* cfg = new RFConfig;
-    tsk->cfg = cfg;
-
-    cfg->deferred_exec_func = deferred_exec_func;
-    cfg->deferred_exec_pdata = deferred_exec_pdata,
-    tsk->evtsub_wakeup = 1;
-    tsk->mtime_wakeup = tsk->mtime_ref + delay;
+//
+// RFLink
+//
 
-    return tsk->taskid;
-}
+RFLinkFunctions::RFLinkFunctions():
+    deviceInit(nullptr),
+    deviceSend(nullptr),
+    deviceReceive(nullptr),
+    deviceSetOpt(nullptr),
+    setInterrupt(nullptr),
+    resetInterrupt(nullptr),
+    deviceGetRxInfo(nullptr),
+    deviceSendStart(nullptr),
+    deviceSendPoll(nullptr),
+    devicePendingFrames(nullptr),
+    deviceRecover(nullptr),
+    channelIsClear(nullptr) {
 
-void RFLink::cancel_deferred_exec() {
-    for (Task* tsk = tskhead; tsk != nullptr; tsk = tsk->next) {
-        if (tsk->status == ST_DEFERRED_EXEC) {
-            tsk->to_destroy = 1;
-        }
-    }
 }
 
-void RFLink::set_opt(opt_t opt, void* data, byte len) {
-    if (!funcs.deviceSetOpt)
-        return;
-
-    (*funcs.deviceSetOpt)(opt, data, len);
+RFLinkFunctionsDriver::RFLinkFunctionsDriver() {
 
-#ifdef ASSUME_DEVICE_ADDRESS_IS_ONE_BYTE
-    if (opt == OPT_ADDRESS) {
-        device_addr_has_been_defined = 1;
-        device_addr = *((byte*)data);
-    }
-#else
-#error "PLEASE REVIEW THIS CODE HERE: NEED TO HANDLE NOT-1-BYTE-LIKE ADDRESSES"
-#endif
 }
 
-void RFLink::set_opt_byte(opt_t opt, byte value) {
-    set_opt(opt, &value, sizeof(value));
+void RFLink::register_funcs(const RFLinkFunctions* arg_funcs) {
+    drv.funcs = *arg_funcs;
+    begin();
 }
 
-void RFLink::set_auto_sleep(bool v) {
-    auto_sleep = v;
-}
+template class RFLinkBase<RFLinkFunctionsDriver>;
 
 
 //
 // PktKeeper
 //
 
-PktKeeper::PktKeeper():pkt(nullptr) {
+PktKeeper::PktKeeper():pkt(nullptr),pkt_len(0) {
 
 }
 
-PktKeeper::PktKeeper(byte pkt_len) {
-    pkt = (Packet*)malloc(pkt_len);
+PktKeeper::PktKeeper(byte buf_len):pkt_len(0) {
+    pkt = (byte*)malloc(buf_len);
 }
 
 PktKeeper::~PktKeeper() {
@@ -1350,19 +606,26 @@ PktKeeper::~PktKeeper() {
 void PktKeeper::copy_packet(const PktKeeper* pktkeeper) {
     assert(!pkt);
 
-    byte len = pktkeeper->get_pkt_len();
-    pkt = (Packet*)malloc(len);
-    memcpy(pkt, pktkeeper->get_pkt_ptr_ro(), len);
+    pkt_len = pktkeeper->get_pkt_len();
+    pkt = (byte*)malloc(pkt_len);
+    memcpy(pkt, pktkeeper->get_pkt_ptr_ro(), pkt_len);
 }
 
-bool PktKeeper::check_rcvd_pkt_is_ok(const RFLink* link, byte nb_bytes) {
+bool PktKeeper::check_rcvd_pkt_is_ok(byte max_payload_len, byte nb_bytes) {
     if (!pkt)
         return false;
 
-    if (pkt->header.len > link->get_max_payload_len())
+    pkt_len = nb_bytes;
+    if (nb_bytes < WIRE_HEADER_LEN)
         return false;
 
-    return (get_pkt_len() == nb_bytes);
+    Header h;
+    header_decode(pkt, nb_bytes, &h);
+
+    if (h.len > max_payload_len)
+        return false;
+
+    return (WIRE_HEADER_LEN + h.len == nb_bytes);
 }
 
 void PktKeeper::release_data() {
@@ -1370,54 +633,63 @@ void PktKeeper::release_data() {
         free(pkt);
         dbg("freeing pkt (release_data)");
         pkt = nullptr;
+        pkt_len = 0;
     }
 }
 
-void PktKeeper::prepare_for_sending(const RFLink* link, Header* header,
+void PktKeeper::prepare_for_sending(byte max_payload_len, Header* header,
                                     const void *data) {
     assert(pkt == nullptr);
 
     assert(   (header->len == 0 && data == nullptr)
            || (header->len >= 1 && data != nullptr));
 
-    pkt = (Packet*)malloc(sizeof(Header) + header->len);
+    Header h = *header;
+    if (h.len > max_payload_len) {
+        h.len = max_payload_len;
+    }
 
-    pkt->header = *header;
+    pkt_len = WIRE_HEADER_LEN + h.len;
+    pkt = (byte*)malloc(pkt_len);
 
-    if (pkt->header.len > link->get_max_payload_len()) {
-        pkt->header.len = link->get_max_payload_len();
-    }
+    header_encode(&h, pkt);
 
-    if (pkt->header.len)
-        memcpy(&pkt->data, data, pkt->header.len);
+    if (h.len)
+        memcpy(pkt + WIRE_HEADER_LEN, data, h.len);
 }
 
-const Header* PktKeeper::get_header_ptr() const {
-    if (!pkt)
-        return nullptr;
+Header PktKeeper::get_header() const {
+    Header h;
+    if (!pkt) {
+        memset(&h, 0, sizeof(h));
+        return h;
+    }
 
-    return &pkt->header;
+    header_decode(pkt, pkt_len, &h);
+    return h;
 }
 
 byte PktKeeper::get_flags() {
     if (!pkt)
         return 0xFF;
 
-    return pkt->header.flags;
+    return get_header().flags;
 }
 
 void PktKeeper::set_flags(byte arg_flags) {
     if (!pkt)
         return;
 
-    pkt->header.flags = arg_flags;
+    Header h = get_header();
+    h.flags = arg_flags;
+    header_encode(&h, pkt);
 }
 
-Packet* PktKeeper::notrecommended_get_pkt_ptr() {
+void* PktKeeper::notrecommended_get_pkt_ptr() {
     return pkt;
 }
 
-const Packet* PktKeeper::get_pkt_ptr_ro() const {
+const void* PktKeeper::get_pkt_ptr_ro() const {
     return pkt;
 }
 
@@ -1425,31 +697,33 @@ byte PktKeeper::get_pkt_len() const {
     if (!pkt)
         return 0;
 
-    return sizeof(Header) + pkt->header.len;
+    return pkt_len;
 }
 
 const void* PktKeeper::get_data_ptr() const {
     if (!pkt)
         return nullptr;
 
-    return &pkt->data;
+    return pkt + WIRE_HEADER_LEN;
 }
 
 byte PktKeeper::get_data_len() const {
     if (!pkt)
         return 0xFF;
 
-    return pkt->header.len;
+    return pkt_len - WIRE_HEADER_LEN;
 }
 
 void PktKeeper::reduce_packet_to_its_header() {
     assert(pkt);
 
-    Packet* new_pkt = (Packet*)malloc(sizeof(Header));
-    new_pkt->header = pkt->header;
-    new_pkt->header.len = 0;
+    Header h = get_header();
+    h.len = 0;
+    byte* new_pkt = (byte*)malloc(WIRE_HEADER_LEN);
+    header_encode(&h, new_pkt);
     free(pkt);
     pkt = new_pkt;
+    pkt_len = WIRE_HEADER_LEN;
 
     dbg("** PACKET REDUCED **");
 }
@@ -1458,11 +732,67 @@ void PktKeeper::copy_data(void *buf, byte buf_len, byte* rec_len) const {
     if (!pkt)
         return;
 
-    *rec_len = pkt->header.len;
+    *rec_len = get_data_len();
     if (*rec_len > buf_len)
         *rec_len = buf_len;
 
     if (*rec_len)
-        memcpy(buf, &pkt->data, *rec_len);
+        memcpy(buf, pkt + WIRE_HEADER_LEN, *rec_len);
+}
+
+// Check a coalesced frame is a well-formed suite of non-empty records, each
+// made of one length byte followed by as many data bytes.
+bool PktKeeper::check_records() const {
+    if (!pkt)
+        return false;
+
+    byte data_len = get_data_len();
+    if (!data_len)
+        return false;
+
+    const byte* d = pkt + WIRE_HEADER_LEN;
+    byte pos = 0;
+    while (pos < data_len) {
+        byte l = d[pos];
+        if (!l || l > data_len - pos - 1)
+            return false;
+        pos += l + 1;
+    }
+
+    return true;
 }
 
+// Copy the record found at position *pos of frame (a coalesced frame), as if
+// it were a packet on its own.
+// Only the last record of the frame inherits FLAG_SIN, see
+// RFLink::tev_received().
+// The object must own a buffer big enough (as recpkt does).
+bool PktKeeper::extract_record(const PktKeeper* frame, byte* pos) {
+    assert(pkt);
+
+    byte frame_len = frame->get_data_len();
+    if (*pos >= frame_len)
+        return false;
+
+    const byte* d = (const byte*)frame->get_data_ptr();
+    byte l = d[*pos];
+    if (!l || l > frame_len - *pos - 1)
+        return false;
+
+    Header h = frame->get_header();
+    h.len = l;
+    memcpy(pkt + WIRE_HEADER_LEN, d + *pos + 1, l);
+    *pos += l + 1;
+
+    byte seq;
+    byte opt;
+    from_flags(h.flags, &seq, &opt);
+    if (*pos < frame_len)
+        opt &= ~FLAG_SIN;
+    h.flags = to_flags(seq, opt);
+
+    header_encode(&h, pkt);
+    pkt_len = WIRE_HEADER_LEN + l;
+
+    return true;
+}
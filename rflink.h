@@ -37,23 +37,182 @@
 // Don't uncomment the below unless you know what you are doing...
 //#define DEBUG_KEEP_SENDING_EVEN_AFTER_RECEIVING_ACK
 
+// Compact on-air header: 'len' is not sent (it is deduced from the packet
+// length reported by the device) and packet ids are 1-byte long.
+// Header then takes 4 bytes over the air, instead of 6.
+// *IMPORTANT*
+// All devices of a network must be compiled with the same setting.
+//#define RFLINK_COMPACT_HEADER
+
+// auto_sleep also sleeps while tasks wait for a deadline (like a deferred
+// execution), waking up with the watchdog timer. Time slept is added to the
+// link clock (without a deadline, it sleeps by watchdog periods as well).
+// *IMPORTANT*
+// rflink.cpp then defines the watchdog interrupt handler (WDT_vect), that
+// the sketch must not use.
+//#define RFLINK_WDT_SLEEP
+
+// Energy accounting (see RFLink::set_energy_model()). Off by default, as it
+// costs RAM and time at each do_events() pass.
+//#define RFLINK_ENERGY
+
+// Optional features. Each one costs RAM per link (and code), they are off by
+// default: uncomment the ones needed.
+// *IMPORTANT*
+// Devices that talk to each other need agree on RFLINK_COALESCE (a device
+// without it drops coalesced frames), and on RFLINK_TDMA, RFLINK_HOP and
+// RFLINK_WOR as soon as one of them uses it.
+
+// Listen before talk, and send jitter (see set_listen_before_talk() and
+// set_send_jitter())
+//#define RFLINK_LBT
+// Airtime accounting and duty cycle (see set_duty_cycle())
+//#define RFLINK_DUTY_CYCLE
+// Automatic emission power (see set_auto_power())
+//#define RFLINK_AUTO_POWER
+// Automatic data rate (see set_auto_rate())
+//#define RFLINK_AUTO_RATE
+// Frequency hopping (see OPT_HOP_CHANNELS)
+//#define RFLINK_HOP
+// Wake-on-radio handled by the link (see OPT_WOR_PERIOD and set_wake_up())
+//#define RFLINK_WOR
+// TDMA (see set_tdma_coordinator() and set_tdma_node())
+//#define RFLINK_TDMA
+// Device health counters (see RFLink::get_health())
+//#define RFLINK_HEALTH
+// Coalescing of small sends (see send_coalesced()), on send and receive sides
+//#define RFLINK_COALESCE
+
 #include <Arduino.h>
 
-#define ENFORCE_MAX_TASK_COUNT_AT_COMPILE_TIME
+// Sizes below are defaults of RFLinkBase template parameters, they can be set
+// per instance, for example:
+//   RFLinkBase<CC1101Driver, 4, 4> rf;   // Small sensor
+//   RFLinkBase<CC1101Driver, 15, 64> rf; // Gateway
+// Number of tasks that can be underway at the same time
 #define DEFAULT_MAX_TASK_COUNT                15
-#define DEFAULT_PRE_ALLOCATE                   0
-#define PKTID_CACHE_SIZE                      10
+// Number of entries of packet ids cache (one entry per source).
+// A gateway receiving from many devices should set it above the number of
+// devices it talks to.
+#define DEFAULT_PKTID_CACHE_SIZE              10
 
 // Delays below are in milliseconds
 #define DEFAULT_RECEIVE_DATA_AVAIL_DELAY     900
 #define DEFAULT_RECEIVE_PURGE_DELAY         1000
 #define DEFAULT_RECEIVE_TIMEOUT_DELAY          0
 #define DEFAULT_SEND_PURGE_DELAY            1000
+// Coalescing of small sends is disabled by default (see send_coalesced())
+#define DEFAULT_COALESCE_DELAY                 0
+// Listen before talk is disabled by default (see set_listen_before_talk())
+#define DEFAULT_LBT_MAX_BACKOFFS               0
+// Backoff delay is drawn at random between 0 and LBT_BACKOFF_UNIT, doubled at
+// each new backoff of a given sending.
+#define LBT_BACKOFF_UNIT                       8
+// No random delay added to sending schedule by default (see set_send_jitter())
+#define DEFAULT_SEND_JITTER                    0
+
+// Airtime accounting (see set_bitrate() and set_duty_cycle())
+// Default values match cc1101wrapper settings: 38.4 kBaud, and, in addition to
+// the packet itself, 4 bytes of preamble, 2 bytes of sync word, 1 byte of
+// length and 2 bytes of CRC.
+#define DEFAULT_BITRATE                    38400
+#define DEFAULT_FRAME_OVERHEAD                 9
+// Duty cycle is not enforced by default
+#define DEFAULT_DUTY_CYCLE                     0
+// Duty cycle is measured over one hour by default
+#define DEFAULT_DUTY_CYCLE_WINDOW        3600000
+// A sending can be deferred up to this delay, waiting for airtime budget.
+#define DEFAULT_DUTY_CYCLE_MAX_DEFER       10000
+
+// Automatic emission power, per destination (see set_auto_power())
+// ACK received with an RSSI (in dBm) below DEFAULT_AUTO_POWER_RSSI_LOW, or ACK
+// missed, and power level is stepped up. AUTO_POWER_STEP_DOWN_ACKS ACKs in a
+// row received with an RSSI above DEFAULT_AUTO_POWER_RSSI_HIGH, and power
+// level is stepped down.
+#define DEFAULT_AUTO_POWER_RSSI_LOW          -85
+#define DEFAULT_AUTO_POWER_RSSI_HIGH         -65
+#define AUTO_POWER_STEP_DOWN_ACKS              4
+
+// Automatic data rate (see set_auto_rate())
+// Rate r (r >= 1) requires a smoothed RSSI (in dBm) of at least
+// DEFAULT_AUTO_RATE_RSSI_BASE + r * AUTO_RATE_RSSI_STEP. Going up requires
+// AUTO_RATE_HYSTERESIS dB more.
+#define DEFAULT_AUTO_RATE_RSSI_BASE         -100
+#define AUTO_RATE_RSSI_STEP                   10
+#define AUTO_RATE_HYSTERESIS                   4
+// Nothing received during this delay, and rate goes back to base rate.
+#define AUTO_RATE_SILENCE_DELAY             5000
+// Both sides switch to a new rate this delay after the ACK that proposed it,
+// so that a repeated sending (the ACK got lost) is still heard at the current
+// rate. Longer than the gaps between sendings of a schedule.
+#define AUTO_RATE_SWITCH_DELAY               500
+
+// Frequency hopping (see OPT_HOP_CHANNELS)
+// Channels hopped over are 0, HOP_CHANNEL_STEP, 2 * HOP_CHANNEL_STEP, etc.
+// Each sending of a packet goes out on the next channel: no more channels than
+// sendings in a schedule (4, see snd_sched and snd_expack_sched in rflink.cpp),
+// otherwise some channels are never tried.
+#define HOP_MAX_CHANNELS                       4
+#define HOP_CHANNEL_STEP                       4
+// A receiving device stays this delay on a channel, before hopping to the next
+// one. Must be longer than a sending schedule (see snd_expack_sched in
+// rflink.cpp).
+#define HOP_DWELL_DELAY                     1000
+
+// Wake-on-radio (see OPT_WOR_PERIOD and set_wake_up())
+// Number of destinations listening with WOR that a link can send to.
+#define WAKE_UP_MAX_DESTINATIONS               4
+// A frame sent to such a destination is repeated during its WOR period (a
+// wake-up train). If an ACK is expected, this delay is left between two frames
+// for the ACK to come in.
+#define WAKE_UP_ACK_GAP                       10
+
+// TDMA (see set_tdma_coordinator() and set_tdma_node())
+// Slots of nodes in a beacon: a beacon must fit in a frame, that is 55 bytes of
+// payload with CC1101 (61 bytes) and 6 bytes of header, the first 9 bytes
+// being beacon header (TDMA_BEACON_HEADER_LEN).
+#define TDMA_MAX_SLOTS                        46
+// Sending is kept this far from slot boundaries, to absorb clock offsets.
+#define TDMA_GUARD                             5
+// A node listens from this delay before beacon is due, until this delay after.
+#define TDMA_BEACON_WINDOW                    20
+// After so many superframes without a beacon, a node is no longer in sync.
+#define TDMA_SYNC_LOST_SUPERFRAMES             4
+
+// Asynchronous sending (see deviceSendStart in RFLinkFunctions) that is not
+// over after this delay is considered failed.
+#define ASYNC_SEND_TIMEOUT                   100
 // The below value makes 49 hours.
 #define CACHE_PKTID_DISCARD_DELAY      176400000
+// An id not ahead of the last one seen from a source is taken for a repeated
+// sending only if received less than this delay after it, otherwise the
+// source is considered restarted (see check_pktid_already_seen()). Longer
+// than a sending schedule, shorter than a device reboot.
+#define PKTID_DUP_DELAY                     2000
 
 #define MIN_DEVICE_RESET_DELAY              1000
 
+// Watchdog timed sleep (see RFLINK_WDT_SLEEP)
+// A deadline nearer than this is waited for awake.
+#define WDT_SLEEP_MIN_DELAY                   32
+// While a packet can wake up CPU, sleep by periods no longer than this, as a
+// period interrupted by device is not added to the clock.
+#define WDT_SLEEP_MAX_PERIOD_LISTENING      1024
+
+// Energy accounting (see RFLINK_ENERGY): emission power levels told apart,
+// higher levels are counted in the last one.
+#define ENERGY_MAX_TX_LEVELS                   8
+
+// Number of link instances that get an interrupt handler (see
+// rflink_isr_attach() in rflink.cpp), from 1 to 4. An instance created
+// beyond this number polls its device.
+#define RFLINK_MAX_INSTANCES                   2
+
+// A reliable sending that gets no ACK triggers a device recovery (see
+// deviceRecover in RFLinkFunctions), and, past this number of failures in a
+// row (with no packet received in between), a full device reset.
+#define DEVICE_RECOVER_MAX_ATTEMPTS            3
+
 #define POST_DEVICE_RESET_DELAY                1
 
 #define ERR_OK                                 0
@@ -70,6 +229,8 @@
 #define ERR_UNDEFINED                         11
 #define ERR_TASK_UNDERWAY                     12
 #define ERR_TIMEOUT                           13
+#define ERR_DUTY_CYCLE_EXCEEDED               14
+#define ERR_SEND_IN_PROGRESS                  15
 
 // NOTE
 // rflink.cpp assumes an address is 1-byte.
@@ -81,18 +242,34 @@ static_assert(sizeof(address_t) == 1,
                                           // define does not exist
 #define ADDR_BROADCAST                      0xFF
 
+#ifdef RFLINK_COMPACT_HEADER
+typedef uint8_t pktid_t;
+#else
 typedef uint16_t pktid_t;
+#endif
+
+// Window of recently seen packet ids, per source: bit i set means id
+// (last_pktid_seen - i) has been seen.
+// Can be changed to uint16_t (less memory) or uint64_t (larger window).
+typedef uint32_t pktid_window_t;
+#define PKTID_WINDOW_SIZE (8 * sizeof(pktid_window_t))
 
 typedef uint16_t taskid_t;
 
 // "m" like milliseconds
 typedef long unsigned int mtime_t;
 
+typedef void (*isr_func_t)();
+// Clock source (see RFLink::set_clock())
+typedef uint32_t (*clock_func_t)();
+
+// Header is never sent as is: see header_encode() and header_decode() in
+// rflink.cpp for the on-air format.
 struct Header {
     /*
      *  WARNING
      *
-     *  On CC1101, the first byte MUST be the destination address.
+     *  On CC1101, the first byte sent MUST be the destination address.
      */
     address_t dst;
     address_t src;
@@ -101,52 +278,57 @@ struct Header {
     uint8_t len;
 };
 
+// Length of header over the air.
+// Does not depend on sizeof(Header), that can include padding bytes (for
+// example on 32-bit targets).
+#ifdef RFLINK_COMPACT_HEADER
+#define WIRE_HEADER_LEN                        4
+#else
+#define WIRE_HEADER_LEN                        6
+#endif
+
 #define FLAG_NONE 0
 #define FLAG_SIN  (1 << 0)
 #define FLAG_ACK  (1 << 1)
-
-struct Packet {
-    Header header;
-    // 'data' member is never used neither "malloc'ed".
-    // Used to extract address of first byte of data AFTER packet header.
-    //
-    // This position can be referred to as:
-    //   &pkt->header + 1
-    // (therefore, without the need for the below definition)
-    //
-    // However the writer of this code finds it clearer to use instead:
-    //   &pkt->data
-    uint8_t data;
-};
-
-class RFLink;
+// Payload is made of length-prefixed records (see send_coalesced())
+#define FLAG_COAL (1 << 2)
+// TDMA beacon (see set_tdma_coordinator()), handled by the link. Payload is
+// network time at superframe start (4 bytes), slot length (2 bytes), number of
+// slots n (1 byte), delay since superframe start at the time of sending, in
+// milliseconds (2 bytes), then n addresses (slot map). Numbers are
+// little-endian.
+#define FLAG_BEACON (1 << 3)
+#define TDMA_BEACON_HEADER_LEN 9
 
 class PktKeeper {
     private:
-        Packet *pkt;
+        // Packet as sent over the air: WIRE_HEADER_LEN bytes of header
+        // followed by data.
+        byte *pkt;
+        byte pkt_len;
 
     public:
         PktKeeper();
-        PktKeeper(byte pkt_len);
+        PktKeeper(byte buf_len);
         ~PktKeeper();
 
         void release_data();
 
         void copy_packet(const PktKeeper* pktkeeper);
-        bool check_rcvd_pkt_is_ok(const RFLink *link, byte nb_bytes);
+        bool check_rcvd_pkt_is_ok(byte max_payload_len, byte nb_bytes);
 
-        void prepare_for_sending(const RFLink *link, Header* header,
+        void prepare_for_sending(byte max_payload_len, Header* header,
                                  const void *data);
 
-        const Header* get_header_ptr() const;
+        Header get_header() const;
         byte get_flags();
         void set_flags(byte arg_flags);
 
-        const Packet* get_pkt_ptr_ro() const;
+        const void* get_pkt_ptr_ro() const;
         // Yes, getting rid of the below would be cleaner, but to the expense of
         // some dynamic memory (used as intermediate buffer), or, more
         // complexity (ask PktKeeper class to manage reception).
-        Packet* notrecommended_get_pkt_ptr();
+        void* notrecommended_get_pkt_ptr();
 
         byte get_pkt_len() const;
         const void* get_data_ptr() const;
@@ -154,19 +336,117 @@ class PktKeeper {
 
         void copy_data(void *buf, byte buf_len, byte* rec_len) const;
         void reduce_packet_to_its_header();
+
+        bool check_records() const;
+        bool extract_record(const PktKeeper* frame, byte* pos);
 };
 
 typedef enum {
     OPT_ADDRESS = 0,
     OPT_SNIF_MODE,
-    OPT_EMISSION_POWER
+    OPT_EMISSION_POWER,
+    // Power level, from 0 (lowest) to the number of levels of device minus one
+    OPT_EMISSION_POWER_LEVEL,
+    // Data rate profile, from 0 (base rate, the slowest) to the number of
+    // profiles of device minus one
+    OPT_DATA_RATE,
+    // Device channel (frequency), device specific
+    OPT_CHANNEL,
+    // Frequency hopping, handled by the link (device needs OPT_CHANNEL, link
+    // needs RFLINK_HOP).
+    // Number of channels to hop over (byte), up to HOP_MAX_CHANNELS. Zero
+    // disables hopping (device stays on the channel it is on).
+    OPT_HOP_CHANNELS,
+    // Seed of the hopping sequence (uint16_t)
+    OPT_HOP_SEED,
+    // Wake-on-radio period, in milliseconds (uint16_t): device sleeps and
+    // wakes up to listen at this period, range is device specific. Zero means
+    // device listens continuously (default). Senders need set_wake_up().
+    // Needs RFLINK_WOR, so that the link has device listen continuously while
+    // it sends.
+    OPT_WOR_PERIOD
 } opt_t;
 
+#define POWER_LEVEL_UNKNOWN               0xFF
+#define CHANNEL_UNKNOWN                   0xFF
+#define TDMA_SLOT_NONE                    0xFF
+
+// Link quality of a received packet, as reported by the device (see
+// deviceGetRxInfo in RFLinkFunctions).
+#define RSSI_UNKNOWN                        -128
+struct RxInfo {
+    int8_t rssi;     // In dBm
+    uint8_t lqi;     // Device specific (CC1101: the lower, the better)
+    bool crc_ok;
+};
+
+// Device health counters (see RFLink::get_health())
+struct RFHealth {
+    uint16_t acks_missed;       // Reliable sendings that got no ACK
+    uint16_t recoveries;        // Device recoveries (see deviceRecover)
+    uint16_t resets;            // Full device resets
+    byte failures_in_a_row;     // ACKs missed since last packet received
+    uint16_t fec_corrected;     // Bits corrected by FEC (see set_fec())
+    uint16_t fec_failed;        // Packets FEC could not correct, or whose
+                                // FEC CRC did not match
+};
+
+// Current drawn by the board, in each state, used for energy accounting (see
+// RFLINK_ENERGY and RFLink::set_energy_model()).
+struct RFEnergyModel {
+    uint16_t voltage_mv;
+    uint16_t battery_mah;       // Zero if not running on battery
+    uint32_t mcu_ua;            // MCU running (added to rx_ua and idle_ua)
+    uint32_t rx_ua;             // Device listening
+    uint32_t idle_ua;           // Device not listening (no receive task)
+    uint32_t sleep_ua;          // Whole board, during auto_sleep
+    // Device sending, per emission power level (see OPT_EMISSION_POWER_LEVEL).
+    // When level is unknown, the last one is used.
+    byte nb_tx_levels;
+    const uint32_t* tx_ua;
+};
+
+// Energy report (see RFLink::get_energy())
+// Time spent sending is also counted in rx_ms or idle_ms.
+// A sleep the clock did not measure (auto_sleep without RFLINK_WDT_SLEEP) is
+// counted in sleeps_unmeasured, not in sleep_ms. energy_mj is then a lower
+// bound, and uj_per_byte and battery_hours are unknown (zero).
+struct RFEnergy {
+    mtime_t tx_ms;
+    mtime_t rx_ms;
+    mtime_t idle_ms;
+    mtime_t sleep_ms;
+    uint32_t sleeps_unmeasured;
+    uint32_t energy_mj;         // Energy spent
+    uint32_t bytes_delivered;   // Data bytes acknowledged, or received
+    uint32_t uj_per_byte;       // Energy per byte delivered, in microjoules
+    uint32_t battery_hours;     // Battery life at average current drawn
+};
+
+// One entry per remote device (see RFLink::cache_pktid_get()).
+// Used to record packet ids seen, and to keep link quality, of this device.
 typedef struct {
-    bool used;
+    unsigned char used        :1;
+    unsigned char pktid_known :1;
+    unsigned char lq_known    :1;
     address_t src;
     mtime_t mtime;
     pktid_t last_pktid_seen;
+    // Time last_pktid_seen got received
+    mtime_t pktid_mtime;
+    pktid_window_t window;
+    // Smoothed RSSI, in 1/16 dBm
+    int16_t rssi_avg;
+    uint8_t lqi_avg;
+#ifdef RFLINK_AUTO_POWER
+    // Emission power level used to send to this device (see set_auto_power())
+    uint8_t power_level;
+    uint8_t power_good_acks;
+#endif
+#ifdef RFLINK_HOP
+    // Frequency hopping: channel this device was last heard on
+    uint8_t hop_channel;
+#endif
 } cache_pktid_t;
 
 enum {
@@ -188,8 +468,13 @@ enum {
 
 #define TASKID_NONE 0
 
+template <class Driver, byte MaxTasks = DEFAULT_MAX_TASK_COUNT,
+          byte CacheSize = DEFAULT_PKTID_CACHE_SIZE>
+class RFLinkBase;
+
 class RFConfig {
-    friend class RFLink;
+    template <class Driver, byte MaxTasks, byte CacheSize>
+    friend class RFLinkBase;
 
     private:
         void (*deferred_exec_func)(void *pdata);
@@ -207,11 +492,10 @@ class RFConfig {
 };
 
 class Task {
-    friend class RFLink;
+    template <class Driver, byte MaxTasks, byte CacheSize>
+    friend class RFLinkBase;
 
     private:
-        Task* next;
-
         taskid_t taskid;
         byte status;
 
@@ -237,7 +521,17 @@ class Task {
         unsigned char to_execute       :1;
         unsigned char to_destroy       :1;
 
+        // Device is transmitting the packet (asynchronous sending)
+        unsigned char tx_pending       :1;
+        // Packet is being repeated as a wake-up train (see set_wake_up())
+        unsigned char wake_train       :1;
+
         byte nbsend;
+#ifdef RFLINK_LBT
+        byte nb_backoffs;
+#endif
+
+        RxInfo rxinfo;
 
         RFConfig *cfg;
 };
@@ -251,15 +545,148 @@ struct RFLinkFunctions {
     void (*setInterrupt)(void (*func)());
     void (*resetInterrupt)();
 
+    // Optional: link quality of the packet last returned by deviceReceive
+    void (*deviceGetRxInfo)(RxInfo* info);
+
+    // Optional: asynchronous sending. When both are registered, they are
+    // used instead of deviceSend.
+    // deviceSendStart starts the transmission and returns straight away.
+    // deviceSendPoll returns ERR_SEND_IN_PROGRESS while the transmission is
+    // underway, then the final status of it (same as deviceSend).
+    byte (*deviceSendStart)(const void* data, byte len);
+    byte (*deviceSendPoll)();
+
+    // Optional: return non-zero if deviceReceive has more packets at hand
+    // (read from device but not yet returned).
+    byte (*devicePendingFrames)();
+
+    // Optional: cheap recovery of device (flush FIFOs, recalibrate...), tried
+    // before a full reset (deviceInit with reset_only set). Return false if
+    // the device is found in a stuck state.
+    bool (*deviceRecover)();
+
+    // Optional: used by listen before talk, return true if nothing is being
+    // transmitted on the channel.
+    bool (*channelIsClear)();
+
     RFLinkFunctions();
 };
 
-class RFLink {
+// Device driver bound at compile time (see RFLinkBase).
+// A driver derives from RFDriver and defines the below as static
+// member-functions:
+//   static void init(byte *max_data_len, bool reset_only);
+//   static byte send(const void* data, byte len);
+//   static byte receive(void* buf, byte buf_len);
+//   static void set_interrupt(void (*func)());
+//   static void reset_interrupt();
+// The other ones are optional, RFDriver provides defaults that match
+// RFLinkFunctions' optional members not being registered. See RFLinkFunctions
+// for the meaning of each.
+struct RFDriver {
+    static bool registered() { return true; }
+    static bool can_send() { return true; }
+    static bool can_receive() { return true; }
+    static bool can_set_opt() { return true; }
+
+    static void set_opt(opt_t, void*, byte) { }
+
+    // Return false if link quality is not available
+    static bool get_rx_info(RxInfo*) { return false; }
+
+    static bool has_async_send() { return false; }
+    static byte send_start(const void*, byte) { return ERR_SEND_IO; }
+    static byte send_poll() { return ERR_SEND_IO; }
+
+    static byte pending_frames() { return 0; }
+
+    static bool has_recover() { return false; }
+    static bool recover() { return false; }
+
+    static bool channel_is_clear() { return true; }
+};
+
+// Device driver bound at run time, through RFLinkFunctions (see RFLink).
+class RFLinkFunctionsDriver {
+    public:
+        RFLinkFunctions funcs;
+
+        RFLinkFunctionsDriver();
+
+        bool registered() const { return funcs.deviceInit; }
+        bool can_send() const { return funcs.deviceSend; }
+        bool can_receive() const { return funcs.deviceReceive; }
+        bool can_set_opt() const { return funcs.deviceSetOpt; }
+
+        void init(byte *max_data_len, bool reset_only) {
+            (*funcs.deviceInit)(max_data_len, reset_only);
+        }
+        byte send(const void* data, byte len) {
+            return (*funcs.deviceSend)(data, len);
+        }
+        byte receive(void* buf, byte buf_len) {
+            return (*funcs.deviceReceive)(buf, buf_len);
+        }
+        void set_opt(opt_t opt, void* data, byte len) {
+            (*funcs.deviceSetOpt)(opt, data, len);
+        }
+        void set_interrupt(void (*func)()) { (*funcs.setInterrupt)(func); }
+        void reset_interrupt() { (*funcs.resetInterrupt)(); }
+
+        bool get_rx_info(RxInfo* info) {
+            if (!funcs.deviceGetRxInfo)
+                return false;
+            (*funcs.deviceGetRxInfo)(info);
+            return true;
+        }
+
+        bool has_async_send() const {
+            return funcs.deviceSendStart && funcs.deviceSendPoll;
+        }
+        byte send_start(const void* data, byte len) {
+            return (*funcs.deviceSendStart)(data, len);
+        }
+        byte send_poll() { return (*funcs.deviceSendPoll)(); }
+
+        byte pending_frames() {
+            if (!funcs.devicePendingFrames)
+                return 0;
+            return (*funcs.devicePendingFrames)();
+        }
+
+        bool has_recover() const { return funcs.deviceRecover; }
+        bool recover() { return (*funcs.deviceRecover)(); }
+
+        bool channel_is_clear() {
+            return !funcs.channelIsClear || (*funcs.channelIsClear)();
+        }
+};
+
+// Link over a device driver known at compile time: calls to the driver are
+// direct (no function pointer, no check of registration), therefore they can
+// be inlined.
+// See RFLink for a device driver registered at run time.
+// MaxTasks and CacheSize: see DEFAULT_MAX_TASK_COUNT and
+// DEFAULT_PKTID_CACHE_SIZE.
+template <class Driver, byte MaxTasks, byte CacheSize>
+class RFLinkBase {
+    static_assert(MaxTasks >= 1, "MaxTasks must be at least 1");
+    static_assert(CacheSize >= 1, "CacheSize must be at least 1");
+
+    protected:
+        Driver drv;
+
     private:
 
 // Variables
 
         byte max_payload_len;
+        // Frame length of device, as told by device init function
+        byte device_max_len;
+
+        // FEC encoding/decoding buffer, non-null if FEC is enabled
+        unsigned char fec :1;
+        byte* fec_buf;
 
         // The below is NOT about Arduino' instructions noInterrupts() and
         // interrupts().
@@ -274,8 +701,13 @@ class RFLink {
         //            detachInterrupt() got called)
         unsigned char interrupt_is_attached :1;
 
+        unsigned char last_is_eligible_for_sleep :1;
+
+        // Set by device interrupt handler (isr_func)
+        volatile bool interrupted;
+        isr_func_t isr_func;
+
         unsigned char device_addr_has_been_defined :1;
-        unsigned char pre_allocate :1;
 
         unsigned char auto_sleep :1;
 
@@ -290,22 +722,161 @@ class RFLink {
 
         mtime_t last_device_reset;
 
+        // Clock (see set_clock()). With a clock source in microseconds,
+        // clock_ms is worked out from clock_us, the last source time read.
+        clock_func_t clock_func;
+        bool clock_in_us;
+        mtime_t clock_ms;
+        uint32_t clock_us;
+        mtime_t clock_slept;
+
+#ifdef RFLINK_LBT
+        byte lbt_max_backoffs;
+        mtime_t send_jitter;
+        uint16_t rand_state;
+#endif
+
+        // Airtime of frames (see set_bitrate())
+        uint32_t bitrate;
+        byte frame_overhead;
+#ifdef RFLINK_DUTY_CYCLE
+        // Airtime accounting. Budget (airtime_tokens) is in microseconds of
+        // airtime, it can be negative as ACKs are always sent.
+        uint16_t duty_permille;
+        mtime_t duty_max_defer;
+        int32_t airtime_capacity;
+        int32_t airtime_tokens;
+        mtime_t airtime_last_refill;
+        mtime_t airtime_used_ms;
+        uint16_t airtime_used_us;
+#endif
+
+#ifdef RFLINK_AUTO_POWER
+        // Automatic emission power. Zero power levels means disabled.
+        byte power_nb_levels;
+        int8_t power_rssi_low;
+        int8_t power_rssi_high;
+#endif
+        // Emission power level device was last set to
+        byte power_level_applied;
+
+#ifdef RFLINK_AUTO_RATE
+        // Automatic data rate. Zero rates means disabled.
+        byte rate_nb;
+        const uint32_t* rate_bitrates;
+        int8_t rate_rssi_base;
+        // rate_next, if not rate_cur, is switched to at rate_switch. The link
+        // has one peer (rate_peer) as long as rate_multi_peers is not set.
+        byte rate_cur;
+        byte rate_next;
+        mtime_t rate_switch;
+        mtime_t rate_last_rx;
+        address_t rate_peer;
+        unsigned char rate_peer_known :1;
+        unsigned char rate_multi_peers :1;
+#endif
+
+        // Channel device was last set to
+        byte channel_applied;
+
+#ifdef RFLINK_HOP
+        // Frequency hopping. Zero channels means disabled.
+        // hop_idx is the index in hop_seq of the channel listened to, and
+        // hop_rx_channel the channel the last packet was received on (ACKs
+        // are sent on it).
+        byte hop_nb;
+        uint16_t hop_seed;
+        byte hop_seq[HOP_MAX_CHANNELS];
+        byte hop_idx;
+        byte hop_rx_channel;
+        mtime_t hop_next;
+#endif
+
+#ifdef RFLINK_WOR
+        // Wake-on-radio. wor_period is the WOR period of device (zero if it
+        // listens continuously), and wor_applied the one device is set to: it
+        // listens continuously while a sending is underway.
+        uint16_t wor_period;
+        uint16_t wor_applied;
+        // Destinations listening with WOR, and their WOR period (zero if entry
+        // is free)
+        address_t wake_dst[WAKE_UP_MAX_DESTINATIONS];
+        uint16_t wake_period[WAKE_UP_MAX_DESTINATIONS];
+#endif
+
+#ifdef RFLINK_TDMA
+        // TDMA. Zero slots means disabled. Slot 0 is the one of coordinator
+        // (beacon), slot i (i >= 1) the one of tdma_map[i - 1]. tdma_ref is
+        // the start of a superframe, and tdma_offset the network time (time of
+        // coordinator) minus local time.
+        unsigned char tdma_coordinator :1;
+        unsigned char tdma_node        :1;
+        unsigned char tdma_synced      :1;
+        byte tdma_nb_slots;
+        uint16_t tdma_slot_len;
+        const address_t* tdma_map;
+        byte tdma_slot;
+        mtime_t tdma_ref;
+        mtime_t tdma_last_beacon;
+        mtime_t tdma_offset;
+#endif
+
+#ifdef RFLINK_ENERGY
+        // Energy accounting, disabled if energy_model is null. Time is
+        // accounted per state, charge is worked out by get_energy() only.
+        const RFEnergyModel* energy_model;
+        RFEnergy energy;
+        // Time spent sending per emission power level, and of it, while
+        // listening (the rest being while not listening)
+        mtime_t energy_tx_level_ms[ENERGY_MAX_TX_LEVELS];
+        mtime_t energy_tx_rx_ms;
+        uint16_t energy_tx_us;
+        mtime_t energy_last;
+        bool energy_listening;
+#endif
+
+        // Task whose packet is being transmitted (asynchronous sending)
+        Task* tx_task;
+        mtime_t tx_started;
+        // Device recovery (or reset) due once transmission is over
+        bool device_reset_deferred;
+
+        // ACKs missed since last packet received (device recovery)
+        byte failures_in_a_row;
+#ifdef RFLINK_HEALTH
+        RFHealth health;
+#endif
+
         PktKeeper *recpkt;
 
+#ifdef RFLINK_COALESCE
+        // Send side of coalescing: records waiting to be sent in one frame
+        mtime_t coalesce_delay;
+        mtime_t coal_deadline;
+        byte* coal_buf;
+        byte coal_len;
+        address_t coal_dst;
+        unsigned char coal_ack :1;
+
+        // Receive side of coalescing: frame whose records are being handed
+        // over, one per do_events() pass.
+        PktKeeper coalpkt;
+        byte coalpkt_pos;
+        RxInfo coalpkt_rxinfo;
+#endif
+
+        // Link quality of recpkt
+        RxInfo rcv_rxinfo;
+
         byte task_count;
-        byte max_task_count;
 
         // Will gracefully manage packet ids (that is, discard a given packet if
         // id already seen for a given source), up to as many different sources.
-        cache_pktid_t cache_pktids[PKTID_CACHE_SIZE];
+        // Open-addressed hash table keyed by source, see cache_pktid_get().
+        cache_pktid_t cache_pktids[CacheSize];
 
-#ifndef ENFORCE_MAX_TASK_COUNT_AT_COMPILE_TIME
-        Task* tskhead;
-#else
-        Task tskhead[DEFAULT_MAX_TASK_COUNT];
-#endif
-
-        RFLinkFunctions funcs;
+        // Tasks not underway have status ST_NOTHING
+        Task tasks[MaxTasks];
 
 // Member-functions
 
@@ -318,19 +889,100 @@ class RFLink {
         void task_reset(Task* tsk);
         Task* task_create(byte status);
 
+        static byte cache_pktid_hash(address_t src);
+        void cache_pktid_remove(byte idx);
+        cache_pktid_t* cache_pktid_get(address_t src, bool* created);
+        const cache_pktid_t* cache_pktid_find(address_t src);
         bool check_pktid_already_seen(address_t src, pktid_t pktid);
+        void update_link_quality(address_t src, const RxInfo* rxinfo);
+
+#ifdef RFLINK_AUTO_POWER
+        void power_apply(address_t dst);
+        void power_on_ack(address_t dst, int8_t rssi);
+        void power_on_missed_ack(address_t dst);
+#endif
+
+#ifdef RFLINK_AUTO_RATE
+        void rate_apply(byte rate);
+        void rate_propose(byte rate);
+        void rate_on_peer(address_t addr);
+        byte rate_hint(address_t src);
+#endif
+
+#ifdef RFLINK_HOP
+        void hop_build();
+        void hop_apply(byte channel);
+        void hop_send(const Task* tsk);
+        void hop_on_received(address_t src);
+        void hop_on_events();
+#endif
+
+#ifdef RFLINK_WOR
+        void wor_apply(uint16_t period);
+        void wor_on_events();
+        uint16_t wake_up_period(address_t dst) const;
+        bool wake_train_next(Task* tsk);
+#endif
+
+        void device_reapply();
+
+#ifdef RFLINK_TDMA
+        mtime_t tdma_superframe() const;
+        mtime_t tdma_delay(uint32_t airtime);
+        bool tdma_listening();
+        void tdma_send_beacon();
+        bool tdma_beacon_stamp(PktKeeper* pk);
+        void tdma_on_beacon(const PktKeeper* pk);
+        void tdma_on_events();
+#endif
+
+        void send_post(Task* tsk, byte r);
+        bool send_poll(Task* tsk);
+        void send_ack_missed(Task* tsk);
+        byte send_schedule_next(Task* tsk);
 
         Task* get_task_by_taskid(taskid_t taskid);
 
+#ifdef RFLINK_LBT
+        uint16_t rand16();
+        mtime_t draw_send_jitter();
+#endif
+
+        uint32_t frame_airtime(byte pkt_len) const;
+#ifdef RFLINK_DUTY_CYCLE
+        void airtime_refill();
+#endif
+#if defined(RFLINK_DUTY_CYCLE) || defined(RFLINK_ENERGY)
+        void airtime_account(uint32_t airtime);
+#endif
+
+#ifdef RFLINK_WDT_SLEEP
+        bool is_eligible_for_timed_sleep(mtime_t* delay);
+#endif
+
+#ifdef RFLINK_ENERGY
+        void energy_on_events(bool listening);
+        void energy_on_tx(uint32_t airtime);
+        void energy_on_sleep(mtime_t d);
+#endif
+
+        byte send_frame_noblock(taskid_t* taskid, address_t dst,
+                                const void* data, byte len, bool ack,
+                                byte opt);
+#ifdef RFLINK_COALESCE
+        bool extract_next_record();
+#endif
+
         void initialize_recpkt_if_necessary();
+        void payload_setup();
 
     public:
 
-        RFLink(byte maxtask = DEFAULT_MAX_TASK_COUNT,
-               unsigned char prealloc = DEFAULT_PRE_ALLOCATE);
-        ~RFLink();
+        RFLinkBase();
+        ~RFLinkBase();
 
-        void register_funcs(const RFLinkFunctions* arg_funcs);
+        // Initialize device
+        void begin();
         static byte get_header_len();
 
         byte get_max_payload_len() const;
@@ -341,27 +993,96 @@ class RFLink {
         void set_opt(opt_t opt, void* data, byte len);
         void set_opt_byte(opt_t opt, byte value);
 
+        void set_clock(clock_func_t func, bool in_us = false);
+        void clock_add_sleep(mtime_t d);
+        mtime_t get_current_time();
+
         void set_auto_sleep(bool v);
+#ifdef RFLINK_COALESCE
+        void set_coalesce_delay(mtime_t d);
+#endif
+#ifdef RFLINK_LBT
+        void set_listen_before_talk(byte max_backoffs);
+        void set_send_jitter(mtime_t j);
+#endif
+        bool set_fec(bool v);
+#ifdef RFLINK_WOR
+        bool set_wake_up(address_t dst, uint16_t period);
+#endif
+
+#ifdef RFLINK_TDMA
+        bool set_tdma_coordinator(uint16_t slot_len, const address_t* slot_map,
+                                  byte nb_slots);
+        void set_tdma_node(bool v);
+        bool tdma_is_synced() const;
+        mtime_t get_network_time();
+#endif
+
+        void set_bitrate(uint32_t bps,
+                         byte overhead_bytes = DEFAULT_FRAME_OVERHEAD);
+#ifdef RFLINK_DUTY_CYCLE
+        void set_duty_cycle(uint16_t permille,
+                            mtime_t window = DEFAULT_DUTY_CYCLE_WINDOW,
+                            mtime_t max_defer = DEFAULT_DUTY_CYCLE_MAX_DEFER);
+        uint32_t get_airtime_budget();
+        mtime_t get_airtime_used() const;
+#endif
+
+#ifdef RFLINK_AUTO_POWER
+        void set_auto_power(byte nb_levels,
+                            int8_t rssi_low = DEFAULT_AUTO_POWER_RSSI_LOW,
+                            int8_t rssi_high = DEFAULT_AUTO_POWER_RSSI_HIGH);
+        byte get_power_level(address_t dst);
+#endif
+
+#ifdef RFLINK_HEALTH
+        void get_health(RFHealth* h) const;
+#endif
+
+#ifdef RFLINK_ENERGY
+        void set_energy_model(const RFEnergyModel* model);
+        void get_energy(RFEnergy* e) const;
+        void reset_energy();
+#endif
+
+#ifdef RFLINK_AUTO_RATE
+        bool set_auto_rate(byte nb_rates, const uint32_t* bitrates = nullptr,
+                           int8_t rssi_base = DEFAULT_AUTO_RATE_RSSI_BASE);
+        byte get_data_rate() const;
+#endif
 
         void do_events();
 
         byte send_noblock(taskid_t* taskid, address_t dst,
                           const void* data, byte len, bool ack);
-        byte send_ack_noblock(taskid_t* taskid, Header* h);
+        byte send_ack_noblock(taskid_t* taskid, Header* h,
+                              const void* data = nullptr);
         byte send_get_final_status(taskid_t taskid, byte *nbsend = nullptr);
         void send_ack(Task* tsk);
         byte send(address_t dst, const void* data, byte len, bool ack,
                   byte *nbsend = nullptr);
 
+#ifdef RFLINK_COALESCE
+        byte send_coalesced(address_t dst, const void* data, byte len,
+                            bool ack);
+        byte coalesce_flush(taskid_t* taskid = nullptr);
+#endif
+
         byte tev_wakeup(Task* tsk);
         byte tev_received(Task* tsk, PktKeeper* pk, bool pktid_already_seen,
                           bool* pkt_consumed);
 
         byte receive_noblock(taskid_t* taskid, RFConfig* cfg = nullptr);
         byte data_retrieve(Task* tsk, void* buf, byte buf_len, byte* rec_len,
-                           address_t* sender);
+                           address_t* sender, RxInfo* rxinfo = nullptr);
+        byte receive_get_data(taskid_t taskid, void* buf, byte buf_len,
+                              byte* rec_len, address_t* sender = nullptr,
+                              RxInfo* rxinfo = nullptr);
         byte receive(void* buf, byte buf_len, byte* rec_len,
-                     address_t* sender = nullptr, RFConfig* cfg = nullptr);
+                     address_t* sender = nullptr, RFConfig* cfg = nullptr,
+                     RxInfo* rxinfo = nullptr);
+
+        bool get_link_quality(address_t addr, RxInfo* avg);
 
         void data_retrieved_post(Task* tsk);
         byte task_get_status(taskid_t taskid);
@@ -379,5 +1100,16 @@ class RFLink {
 
 };
 
+// Link over a device driver registered at run time, see register_funcs().
+class RFLink : public RFLinkBase<RFLinkFunctionsDriver> {
+    public:
+        void register_funcs(const RFLinkFunctions* arg_funcs);
+};
+
+#include "rflink_impl.h"
+
+// Instantiated once, in rflink.cpp
+extern template class RFLinkBase<RFLinkFunctionsDriver>;
+
 #endif // _RFLINK_H
 
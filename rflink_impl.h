@@ -0,0 +1,3224 @@
+// vim:ts=4:sw=4:tw=80:et
+/*
+  rflink_impl.h
+
+  Member-functions of RFLinkBase.
+  RFLinkBase being a class template, its member-functions are defined in a
+  header, included at the end of rflink.h. Don't include this file directly.
+*/
+
+/*
+  Copyright 2020 Sébastien Millet
+
+  rflink is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  rflink is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program. If not, see
+  <https://www.gnu.org/licenses>.
+*/
+
+#ifndef _RFLINK_IMPL_H
+#define _RFLINK_IMPL_H
+
+#include <avr/sleep.h>
+
+#ifdef RFLINK_DEBUG
+#include "debug.h"
+#else
+#include <assert.h>
+#endif
+
+// Macros below are restored at the end of this file, not to leak inside code
+// that includes rflink.h.
+#pragma push_macro("dbg")
+#pragma push_macro("dbgf")
+#pragma push_macro("dbgbin")
+#pragma push_macro("ET_REG")
+#pragma push_macro("ET_PRTPERIOD")
+
+#ifndef RFLINK_DEBUG
+
+#undef dbg
+#define dbg(a)
+#undef dbgf
+#define dbgf(...)
+#undef dbgbin
+#define dbgbin(a, b, c)
+
+#endif
+
+#if !defined(RFLINK_DEBUG) || !defined(RFLINK_DEBUG_EVENTTIMER)
+
+#undef ET_REG
+#define ET_REG(...)
+#undef ET_PRTPERIOD
+#define ET_PRTPERIOD(a)
+
+#else
+
+#ifdef RFLINK_DEBUG_EVENTTIMER_ONLY
+
+#undef dbg
+#define dbg(a)
+#undef dbgf
+#define dbgf(...)
+#undef dbgbin
+#define dbgbin(a, b, c)
+
+#endif // RFLINK_DEBUG_EVENTTIMER_ONLY
+
+extern EventTimer rflink_et;
+void rflink_et_strings();
+#undef ET_REG
+#define ET_REG(...)      rflink_et.ev_reg(__VA_ARGS__)
+#undef ET_PRTPERIOD
+#define ET_PRTPERIOD(a)  rflink_et.ev_print_by_period(a)
+
+// Don't use zero for a real event (it is used to mark array entries as being
+// unused).
+enum {
+    EV_NONE = 0,                     // Never use it
+    EV_SEND_CALL,
+    EV_SENT_OK,
+    EV_SENT_NOTOK,
+    EV_RECEIVE_CALL,
+    EV_RECEIVED_OK,
+    EV_RECEIVED_NOTOK,
+    EV_RECEIVED_0_BYTE_RCVD
+};
+
+#endif // !defined(RFLINK_DEBUG) || !defined(RFLINK_DEBUG_EVENTTIMER);
+
+// Sending schedules, see rflink.cpp
+extern const mtime_t snd_sched[];
+extern const byte snd_sched_len;
+extern const mtime_t snd_expack_sched[];
+extern const byte snd_expack_sched_len;
+extern const mtime_t snd_repack_sched[];
+extern const byte snd_repack_sched_len;
+
+isr_func_t rflink_isr_attach(volatile bool* flag);
+void rflink_isr_detach(isr_func_t func);
+
+const char* rflink_get_err_string(byte errcode);
+
+#ifdef RFLINK_WDT_SLEEP
+mtime_t rflink_wdt_sleep(mtime_t d, mtime_t max_period,
+                         volatile bool* wake_flag);
+#endif
+
+// FEC body ends with a CRC of the packet (see rflink_fec_encode()). The
+// destination address (first byte of header) is sent in clear, for the device
+// to filter on it.
+#define FEC_CRC_LEN 1
+#define FEC_CLEAR_LEN 1
+void rflink_fec_encode(const void* in, byte len, byte clear_len, byte* out);
+byte rflink_fec_decode(const byte* in, byte len, byte clear_len, void* out,
+                       uint16_t* corrected);
+
+// Length over the air of a packet of pkt_len bytes, once FEC encoded
+static inline uint16_t fec_wire_len(byte pkt_len) {
+    return FEC_CLEAR_LEN
+           + 2 * ((uint16_t)pkt_len - FEC_CLEAR_LEN + FEC_CRC_LEN);
+}
+
+static inline uint8_t to_flags(byte seq, byte opt) {
+    return ((seq & 0x0F) << 4) | (opt & 0x0F);
+}
+
+static inline void from_flags(byte flags, byte* seq, byte* opt) {
+    *opt = (flags & 0x0F);
+    *seq = flags >> 4;
+}
+
+//
+// Tasks
+//
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::task_destroy(Task* tsk) {
+    if (tsk == tx_task)
+        tx_task = nullptr;
+    tsk->pktkeeper.release_data();
+    task_reset(tsk);
+
+    --task_count;
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::task_reset(Task* tsk) {
+    tsk->taskid = 0;
+    tsk->status = ST_NOTHING;
+    tsk->evtsub_wakeup = 0;
+    tsk->evtsub_pktrcvd = 0;
+    tsk->last_retcode = ERR_UNDEFINED;
+    tsk->to_execute = 0;
+    tsk->to_destroy = 0;
+
+    if (tsk->cfg) {
+        delete tsk->cfg;
+        tsk->cfg = nullptr;
+    }
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+Task* RFLinkBase<Driver, MaxTasks, CacheSize>::task_create(byte status) {
+    if (task_count >= MaxTasks)
+        return nullptr;
+
+    Task* tsk = tasks;
+    while (tsk->status != ST_NOTHING)
+        ++tsk;
+
+    tsk->cfg = nullptr;
+    task_reset(tsk);
+
+    ++last_taskid;
+    if (last_taskid == TASKID_NONE)
+        ++last_taskid;
+    tsk->taskid = last_taskid;
+    tsk->status = status;
+    tsk->mtime_ref = get_current_time();
+
+    tsk->is_an_ack = 0;
+    tsk->need_ack = 0;
+    tsk->has_received_ack = 0;
+    tsk->unattended = 0;
+
+    tsk->nbsend = 0;
+#ifdef RFLINK_LBT
+    tsk->nb_backoffs = 0;
+#endif
+    tsk->tx_pending = 0;
+    tsk->wake_train = 0;
+
+    tsk->rxinfo.rssi = RSSI_UNKNOWN;
+    tsk->rxinfo.lqi = 0;
+    tsk->rxinfo.crc_ok = true;
+
+    ++task_count;
+
+    return tsk;
+}
+
+//
+// RFLink
+//
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+RFLinkBase<Driver, MaxTasks, CacheSize>::RFLinkBase():
+      max_payload_len(0),
+      device_max_len(0),
+      fec(0),
+      fec_buf(nullptr),
+      interrupt_is_attached(0),
+      last_is_eligible_for_sleep(0),
+      interrupted(false),
+      device_addr_has_been_defined(0),
+      auto_sleep(0),
+      device_addr(0x00),
+      last_pktid(0),
+      last_taskid(TASKID_NONE),
+      receive_data_avail_delay(DEFAULT_RECEIVE_DATA_AVAIL_DELAY),
+      receive_purge_delay(DEFAULT_RECEIVE_PURGE_DELAY),
+      send_purge_delay(DEFAULT_SEND_PURGE_DELAY),
+      last_device_reset(0),
+      clock_func(nullptr),
+      clock_in_us(false),
+      clock_ms(0),
+      clock_us(0),
+      clock_slept(0),
+#ifdef RFLINK_LBT
+      lbt_max_backoffs(DEFAULT_LBT_MAX_BACKOFFS),
+      send_jitter(DEFAULT_SEND_JITTER),
+      rand_state(1),
+#endif
+      bitrate(DEFAULT_BITRATE),
+      frame_overhead(DEFAULT_FRAME_OVERHEAD),
+#ifdef RFLINK_DUTY_CYCLE
+      duty_permille(DEFAULT_DUTY_CYCLE),
+      duty_max_defer(DEFAULT_DUTY_CYCLE_MAX_DEFER),
+      airtime_capacity(0),
+      airtime_tokens(0),
+      airtime_last_refill(0),
+      airtime_used_ms(0),
+      airtime_used_us(0),
+#endif
+#ifdef RFLINK_AUTO_POWER
+      power_nb_levels(0),
+      power_rssi_low(DEFAULT_AUTO_POWER_RSSI_LOW),
+      power_rssi_high(DEFAULT_AUTO_POWER_RSSI_HIGH),
+#endif
+      power_level_applied(POWER_LEVEL_UNKNOWN),
+#ifdef RFLINK_AUTO_RATE
+      rate_nb(0),
+      rate_bitrates(nullptr),
+      rate_rssi_base(DEFAULT_AUTO_RATE_RSSI_BASE),
+      rate_cur(0),
+      rate_next(0),
+      rate_switch(0),
+      rate_last_rx(0),
+      rate_peer(0),
+      rate_peer_known(0),
+      rate_multi_peers(0),
+#endif
+      channel_applied(CHANNEL_UNKNOWN),
+#ifdef RFLINK_HOP
+      hop_nb(0),
+      hop_seed(0),
+      hop_idx(0),
+      hop_rx_channel(0),
+      hop_next(0),
+#endif
+#ifdef RFLINK_WOR
+      wor_period(0),
+      wor_applied(0),
+#endif
+#ifdef RFLINK_TDMA
+      tdma_coordinator(0),
+      tdma_node(0),
+      tdma_synced(0),
+      tdma_nb_slots(0),
+      tdma_slot_len(0),
+      tdma_map(nullptr),
+      tdma_slot(TDMA_SLOT_NONE),
+      tdma_ref(0),
+      tdma_last_beacon(0),
+      tdma_offset(0),
+#endif
+      tx_task(nullptr),
+      tx_started(0),
+      device_reset_deferred(false),
+      failures_in_a_row(0),
+      recpkt(nullptr),
+#ifdef RFLINK_COALESCE
+      coalesce_delay(DEFAULT_COALESCE_DELAY),
+      coal_deadline(0),
+      coal_buf(nullptr),
+      coal_len(0),
+      coal_dst(0),
+      coal_ack(0),
+      coalpkt_pos(0),
+#endif
+      task_count(0) {
+
+    isr_func = rflink_isr_attach(&interrupted);
+
+    for (unsigned int i = 0; i < CacheSize; ++i) {
+        cache_pktids[i].used = 0;
+    }
+#ifdef RFLINK_WOR
+    for (byte i = 0; i < WAKE_UP_MAX_DESTINATIONS; ++i) {
+        wake_period[i] = 0;
+    }
+#endif
+
+    rcv_rxinfo.rssi = RSSI_UNKNOWN;
+    rcv_rxinfo.lqi = 0;
+    rcv_rxinfo.crc_ok = true;
+#ifdef RFLINK_COALESCE
+    coalpkt_rxinfo = rcv_rxinfo;
+#endif
+
+#ifdef RFLINK_HEALTH
+    memset(&health, 0, sizeof(health));
+#endif
+#ifdef RFLINK_ENERGY
+    energy_model = nullptr;
+    memset(&energy, 0, sizeof(energy));
+    memset(energy_tx_level_ms, 0, sizeof(energy_tx_level_ms));
+    energy_tx_rx_ms = 0;
+    energy_tx_us = 0;
+    energy_last = 0;
+    energy_listening = false;
+#endif
+
+#if defined(RFLINK_DEBUG) && defined(RFLINK_DEBUG_EVENTTIMER)
+    rflink_et_strings();
+#endif
+
+    for (byte i = 0; i < MaxTasks; ++i) {
+        tasks[i].cfg = nullptr;
+        task_reset(&tasks[i]);
+    }
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+RFLinkBase<Driver, MaxTasks, CacheSize>::~RFLinkBase() {
+    interrupts_off();
+    rflink_isr_detach(isr_func);
+
+    if (recpkt)
+        delete recpkt;
+#ifdef RFLINK_COALESCE
+    if (coal_buf)
+        free(coal_buf);
+#endif
+    if (fec_buf)
+        free(fec_buf);
+
+    for (byte i = 0; i < MaxTasks; ++i) {
+        task_reset(&tasks[i]);
+    }
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::begin() {
+    if (!drv.registered())
+        return;
+
+    drv.init(&device_max_len, false);
+    payload_setup();
+
+    initialize_recpkt_if_necessary();
+}
+
+// Work out payload length from device frame length, FEC doubling the length
+// of what follows the destination address.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::payload_setup() {
+    if (fec && !fec_buf) {
+        fec_buf = (byte*)malloc(device_max_len);
+        if (!fec_buf)
+            fec = 0;
+    } else if (!fec && fec_buf) {
+        free(fec_buf);
+        fec_buf = nullptr;
+    }
+
+    max_payload_len =
+      (fec ? (device_max_len - FEC_CLEAR_LEN) / 2 - FEC_CRC_LEN
+             - (WIRE_HEADER_LEN - FEC_CLEAR_LEN)
+           : device_max_len - WIRE_HEADER_LEN);
+
+    // Buffers sized after payload length are to be allocated again
+    if (recpkt) {
+        delete recpkt;
+        recpkt = nullptr;
+    }
+#ifdef RFLINK_COALESCE
+    if (coal_buf && !coal_len) {
+        free(coal_buf);
+        coal_buf = nullptr;
+    }
+#endif
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::get_header_len() {
+    return WIRE_HEADER_LEN;
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::get_pkt_max_size() const {
+    return WIRE_HEADER_LEN + max_payload_len;
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::get_max_payload_len() const {
+    return max_payload_len;
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+const char* RFLinkBase<Driver, MaxTasks, CacheSize>::get_err_string(
+           byte errcode) const {
+    return rflink_get_err_string(errcode);
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::initialize_recpkt_if_necessary() {
+    if (!recpkt) {
+        dbg("********** INITIALIZED RECPKT");
+        recpkt = new PktKeeper(get_pkt_max_size());
+    }
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::tev_received(
+           Task* tsk, PktKeeper* pk, bool pktid_already_seen,
+           bool* pkt_consumed) {
+    assert(!*pkt_consumed);
+
+    Header hbackup = pk->get_header();
+    byte ret = tsk->status;
+
+    byte seq;
+    byte opt;
+    from_flags(pk->get_flags(), &seq, &opt);
+
+    if (opt & FLAG_ACK) {
+        if ((tsk->status == ST_SEND || tsk->status == ST_SEND_DONE)) {
+            if (tsk->need_ack && !tsk->has_received_ack) {
+                if (tsk->pktkeeper.get_header().pktid == hbackup.pktid) {
+
+#ifdef RFLINK_AUTO_POWER
+                    power_on_ack(hbackup.src, rcv_rxinfo.rssi);
+#endif
+
+#ifdef RFLINK_AUTO_RATE
+                    // ACK may carry the data rate proposed by its sender
+                    if (rate_nb && pk->get_data_len() >= 1) {
+                        byte hint = *(const byte*)pk->get_data_ptr();
+                        if (hint < rate_nb)
+                            rate_propose(hint);
+                        // Same as the receiver does when it gets a repeated
+                        // sending (see do_events())
+                        if (tsk->nbsend > 1 && rate_next != rate_cur) {
+                            rate_switch =
+                              get_current_time() + AUTO_RATE_SWITCH_DELAY;
+                        }
+                    }
+#endif
+
+#ifndef DEBUG_KEEP_SENDING_EVEN_AFTER_RECEIVING_ACK
+                    tsk->has_received_ack = 1;
+
+                    if (tsk->status == ST_SEND) {
+                        tsk->mtime_wakeup =
+                          get_current_time() + send_purge_delay;
+                        ret = ST_SEND_DONE;
+                    }
+
+#ifdef RFLINK_ENERGY
+                    energy.bytes_delivered += tsk->pktkeeper.get_data_len();
+#endif
+
+                    // We received ACK: we therefore don't need to keep whole
+                    // packet any longer.
+                    tsk->pktkeeper.reduce_packet_to_its_header();
+
+                    *pkt_consumed = true;
+#endif
+
+                }
+            }
+        }
+        return ret;
+    }
+
+    if (tsk->status == ST_RECEIVE && !pktid_already_seen) {
+
+        tsk->pktkeeper.copy_packet(pk);
+        tsk->rxinfo = rcv_rxinfo;
+        tsk->last_retcode = ERR_OK;
+        *pkt_consumed = true;
+        ret = ST_RECEIVE_DATA_AVAILABLE;
+        tsk->evtsub_wakeup = 1;
+        tsk->mtime_ref = get_current_time();
+        tsk->mtime_wakeup = tsk->mtime_ref + receive_data_avail_delay;
+
+    } else if (tsk->status == ST_RECEIVE_DATA_AVAILABLE
+               || tsk->status == ST_RECEIVE_DATA_RETRIEVED) {
+
+        byte tsk_seq;
+        byte tsk_opt;
+        from_flags(tsk->pktkeeper.get_flags(), &tsk_seq, &tsk_opt);
+
+        // Records of a coalesced frame all share the frame pktid. Only the
+        // last one carries FLAG_SIN, so that it is the one answering (with an
+        // ACK) to a repeated sending of the frame.
+        bool is_a_silent_record =
+          ((tsk_opt & FLAG_COAL) && !(tsk_opt & FLAG_SIN));
+
+        Header tsk_h = tsk->pktkeeper.get_header();
+        if (tsk_h.pktid == hbackup.pktid
+            && tsk_h.src == hbackup.src
+            && !is_a_silent_record) {
+            *pkt_consumed = true;
+
+            if (tsk->status == ST_RECEIVE_DATA_RETRIEVED) {
+                send_ack(tsk);
+            }
+
+        }
+    }
+
+    return ret;
+}
+
+#ifdef RFLINK_LBT
+// xorshift, good enough to draw delays.
+// Seeded with device address (see set_opt()), so that devices woken up at the
+// same time don't draw the same delays.
+template <class Driver, byte MaxTasks, byte CacheSize>
+uint16_t RFLinkBase<Driver, MaxTasks, CacheSize>::rand16() {
+    rand_state ^= rand_state << 7;
+    rand_state ^= rand_state >> 9;
+    rand_state ^= rand_state << 8;
+    return rand_state;
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+mtime_t RFLinkBase<Driver, MaxTasks, CacheSize>::draw_send_jitter() {
+    if (!send_jitter)
+        return 0;
+    return rand16() % (send_jitter + 1);
+}
+#endif
+
+// Airtime of a packet, in microseconds
+template <class Driver, byte MaxTasks, byte CacheSize>
+uint32_t RFLinkBase<Driver, MaxTasks, CacheSize>::frame_airtime(
+           byte pkt_len) const {
+    uint32_t len = (fec_buf ? fec_wire_len(pkt_len) : pkt_len);
+    return ((uint32_t)frame_overhead + len) * 8000000UL / bitrate;
+}
+
+#ifdef RFLINK_DUTY_CYCLE
+// Token bucket: budget grows by duty_permille microseconds per millisecond
+// elapsed, up to airtime_capacity.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::airtime_refill() {
+    mtime_t now = get_current_time();
+    mtime_t elapsed = now - airtime_last_refill;
+    airtime_last_refill = now;
+
+    if (!duty_permille)
+        return;
+
+    uint32_t room = (uint32_t)(airtime_capacity - airtime_tokens);
+    if (elapsed > room / duty_permille)
+        airtime_tokens = airtime_capacity;
+    else
+        airtime_tokens += elapsed * duty_permille;
+}
+#endif
+
+#if defined(RFLINK_DUTY_CYCLE) || defined(RFLINK_ENERGY)
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::airtime_account(
+           uint32_t airtime) {
+#ifdef RFLINK_DUTY_CYCLE
+    airtime_used_us += airtime % 1000;
+    airtime_used_ms += airtime / 1000 + airtime_used_us / 1000;
+    airtime_used_us %= 1000;
+
+    if (duty_permille)
+        airtime_tokens -= airtime;
+#endif
+
+#ifdef RFLINK_ENERGY
+    if (energy_model)
+        energy_on_tx(airtime);
+#endif
+}
+#endif
+
+#ifdef RFLINK_ENERGY
+// Time elapsed since previous call is counted in the state device was in
+// (listening or not).
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::energy_on_events(
+           bool listening) {
+    mtime_t now = get_current_time();
+    mtime_t d = now - energy_last;
+    energy_last = now;
+
+    if (energy_listening)
+        energy.rx_ms += d;
+    else
+        energy.idle_ms += d;
+    energy_listening = listening;
+}
+
+// Sending time is counted as listening (or idle) as well, by
+// energy_on_events(): get_energy() charges it at the current of sending
+// instead.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::energy_on_tx(uint32_t airtime) {
+    energy_tx_us += airtime % 1000;
+    mtime_t ms = airtime / 1000 + energy_tx_us / 1000;
+    energy_tx_us %= 1000;
+
+    byte level = power_level_applied;
+    if (level >= ENERGY_MAX_TX_LEVELS)
+        level = ENERGY_MAX_TX_LEVELS - 1;
+    energy_tx_level_ms[level] += ms;
+    energy.tx_ms += ms;
+    if (energy_listening)
+        energy_tx_rx_ms += ms;
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::energy_on_sleep(mtime_t d) {
+    // Clock stopped while sleeping: time slept is unknown
+    if (!d)
+        ++energy.sleeps_unmeasured;
+    energy.sleep_ms += d;
+    energy_last = get_current_time();
+}
+#endif
+
+// Sending done (or skipped) at current position of schedule: move on to the
+// next one.
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::send_schedule_next(Task* tsk) {
+    tsk->wake_train = 0;
+    tsk->send_schedule_pos++;
+
+    if (tsk->send_schedule_pos < tsk->nb_send_schedules) {
+        tsk->mtime_wakeup =
+          tsk->mtime_ref + tsk->send_schedule_ptr[tsk->send_schedule_pos];
+#ifdef RFLINK_LBT
+        if (!tsk->is_an_ack)
+            tsk->mtime_wakeup += draw_send_jitter();
+#endif
+    } else {
+
+        if (tsk->unattended)
+            tsk->mtime_wakeup = get_current_time();
+        else
+            tsk->mtime_wakeup = get_current_time() + send_purge_delay;
+
+        return ST_SEND_DONE;
+
+    }
+
+    return tsk->status;
+}
+
+// A sending is over (successfully or not)
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::send_post(Task* tsk, byte r) {
+    tsk->last_retcode = r;
+
+#if defined(RFLINK_DUTY_CYCLE) || defined(RFLINK_ENERGY)
+    if (!r)
+        airtime_account(frame_airtime(tsk->pktkeeper.get_pkt_len()));
+#endif
+
+#ifdef RFLINK_AUTO_RATE
+    // The ACK carried a data rate: both sides switch to it after
+    // AUTO_RATE_SWITCH_DELAY.
+    if (!r && tsk->is_an_ack && rate_nb && tsk->pktkeeper.get_data_len() >= 1)
+        rate_propose(*(const byte*)tsk->pktkeeper.get_data_ptr());
+#endif
+
+#ifdef RFLINK_DEBUG
+
+#ifndef RFLINK_DEBUG_EVENTTIMER_ONLY
+    Header h = tsk->pktkeeper.get_header();
+#endif
+    if (r) {
+        ET_REG(EV_SENT_NOTOK);
+
+#ifndef RFLINK_DEBUG_EVENTTIMER_ONLY
+        dbgf("send err: taskid=%u, s=0x%02x, d=0x%02x, fl=0x%02x"
+             ", pktid=0x%04x, len=%i, err=%i: %s",
+             tsk->taskid, h.src, h.dst, h.flags, h.pktid, h.len,
+             r, get_err_string(r));
+#endif
+
+    } else {
+        ET_REG(EV_SENT_OK);
+
+#ifndef RFLINK_DEBUG_EVENTTIMER_ONLY
+        dbgf("send ok:  taskid=%u, s=0x%02x, d=0x%02x, fl=0x%02x"
+             ", pktid=0x%04x, len=%i", tsk->taskid,
+             h.src, h.dst, h.flags, h.pktid, h.len);
+#endif
+
+    }
+#endif // RFLINK_DEBUG
+
+    byte seq;
+    byte opts;
+    from_flags(tsk->pktkeeper.get_flags(), &seq, &opts);
+
+    if (!tsk->is_an_ack)
+        ++seq;
+
+    tsk->pktkeeper.set_flags(to_flags(seq, tsk->pktkeeper.get_flags()));
+}
+
+// Asynchronous sending (see deviceSendStart in RFLinkFunctions): return true
+// once the device is done transmitting.
+template <class Driver, byte MaxTasks, byte CacheSize>
+bool RFLinkBase<Driver, MaxTasks, CacheSize>::send_poll(Task* tsk) {
+    byte r = drv.send_poll();
+    if (r == ERR_SEND_IN_PROGRESS) {
+        if ((get_current_time() - tx_started) < ASYNC_SEND_TIMEOUT) {
+            tsk->mtime_wakeup = get_current_time();
+            return false;
+        }
+        dbgf("taskid=%u: asynchronous sending timed out", tsk->taskid);
+        r = ERR_SEND_IO;
+    }
+
+    tsk->tx_pending = 0;
+    tx_task = nullptr;
+    send_post(tsk, r);
+    return true;
+}
+
+// Previous sending was not acknowledged in due time
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::send_ack_missed(Task* tsk) {
+#ifdef RFLINK_AUTO_POWER
+    if (tsk->need_ack && tsk->nbsend && !tsk->has_received_ack) {
+        power_on_missed_ack(tsk->pktkeeper.get_header().dst);
+    }
+#else
+    (void)tsk;
+#endif
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::tev_wakeup(Task* tsk) {
+
+    if (tsk->status == ST_SEND && tsk->tx_pending) {
+        if (!send_poll(tsk))
+            return tsk->status;
+#ifdef RFLINK_WOR
+        if (wake_train_next(tsk))
+            return tsk->status;
+#endif
+        return send_schedule_next(tsk);
+
+    } else if (tsk->status == ST_SEND) {
+        bool do_send = (!tsk->need_ack
+                        || tsk->send_schedule_pos < tsk->nb_send_schedules - 1);
+
+        // Device is busy sending the packet of another task: retry shortly,
+        // the whole schedule being shifted.
+        if (do_send && tx_task) {
+            tsk->mtime_ref += 1;
+            tsk->mtime_wakeup = get_current_time() + 1;
+            return tsk->status;
+        }
+
+#if defined(RFLINK_TDMA) || defined(RFLINK_DUTY_CYCLE)
+        uint32_t airtime = frame_airtime(tsk->pktkeeper.get_pkt_len());
+#endif
+
+#ifdef RFLINK_TDMA
+        // TDMA: sendings go out in own slot (ACKs and beacons excepted), the
+        // whole schedule being shifted to it.
+        if (do_send && !tsk->is_an_ack && !tsk->wake_train
+            && !(tsk->pktkeeper.get_flags() & FLAG_BEACON)) {
+            mtime_t d = tdma_delay(airtime);
+            if (d) {
+                tsk->mtime_ref += d;
+                tsk->mtime_wakeup = get_current_time() + d;
+                dbgf("taskid=%u: TDMA, sending deferred by %lu ms",
+                     tsk->taskid, d);
+                return tsk->status;
+            }
+        }
+#endif
+
+#ifdef RFLINK_DUTY_CYCLE
+        // Duty cycle: ACKs and beacons are always sent. Other packets are
+        // deferred (first sending) or skipped (repeated sendings) when the
+        // airtime budget is exhausted.
+        if (do_send && duty_permille && !tsk->is_an_ack
+            && !(tsk->pktkeeper.get_flags() & FLAG_BEACON)) {
+            airtime_refill();
+            if (airtime_tokens < (int32_t)airtime) {
+                if (tsk->nbsend) {
+                    dbgf("taskid=%u: duty cycle, sending skipped",
+                         tsk->taskid);
+                    do_send = false;
+                } else {
+                    mtime_t d = ((uint32_t)((int32_t)airtime - airtime_tokens)
+                                 + duty_permille - 1) / duty_permille;
+                    if (d <= duty_max_defer) {
+                        tsk->mtime_ref += d;
+                        tsk->mtime_wakeup = get_current_time() + d;
+                        dbgf("taskid=%u: duty cycle, sending deferred by %lu"
+                             " ms", tsk->taskid, d);
+                        return tsk->status;
+                    }
+                    dbgf("taskid=%u: duty cycle, sending aborted",
+                         tsk->taskid);
+                    tsk->last_retcode = ERR_DUTY_CYCLE_EXCEEDED;
+                    tsk->send_schedule_pos = tsk->nb_send_schedules - 1;
+                    do_send = false;
+                }
+            }
+        }
+#endif
+
+        if (do_send) {
+
+#ifdef RFLINK_LBT
+            // Listen before talk: if channel is busy, wait for a random delay
+            // (that doubles at each backoff). The whole schedule is shifted,
+            // so that the delay to wait for an ACK is left unchanged.
+            if (tsk->nb_backoffs < lbt_max_backoffs
+                && !drv.channel_is_clear()) {
+                mtime_t d =
+                  rand16() % ((mtime_t)LBT_BACKOFF_UNIT << tsk->nb_backoffs);
+                tsk->nb_backoffs++;
+                tsk->mtime_ref += d;
+                tsk->mtime_wakeup = get_current_time() + d;
+                dbgf("taskid=%u: channel busy, backoff #%i of %lu ms",
+                     tsk->taskid, tsk->nb_backoffs, d);
+                return tsk->status;
+            }
+            tsk->nb_backoffs = 0;
+#endif
+
+#ifdef RFLINK_TDMA
+            // TDMA beacon: tells how late it goes out (listen before talk,
+            // device busy), for nodes to find superframe start. Too late,
+            // nodes no longer listen.
+            if ((tsk->pktkeeper.get_flags() & FLAG_BEACON)
+                && !tdma_beacon_stamp(&tsk->pktkeeper)) {
+                dbgf("taskid=%u: TDMA, beacon too late, dropped",
+                     tsk->taskid);
+                return send_schedule_next(tsk);
+            }
+#endif
+
+            // Frames of a wake-up train make one sending
+            if (!tsk->wake_train)
+                send_ack_missed(tsk);
+#ifdef RFLINK_AUTO_POWER
+            power_apply(tsk->pktkeeper.get_header().dst);
+#endif
+#ifdef RFLINK_AUTO_RATE
+            rate_on_peer(tsk->pktkeeper.get_header().dst);
+#endif
+            if (!tsk->wake_train) {
+#ifdef RFLINK_HOP
+                hop_send(tsk);
+#endif
+                tsk->nbsend++;
+            }
+            ET_REG(EV_SEND_CALL);
+
+            const void* pkt = tsk->pktkeeper.get_pkt_ptr_ro();
+            byte pkt_len = tsk->pktkeeper.get_pkt_len();
+            if (fec_buf) {
+                rflink_fec_encode(pkt, pkt_len, FEC_CLEAR_LEN, fec_buf);
+                pkt = fec_buf;
+                pkt_len = fec_wire_len(pkt_len);
+            }
+
+            if (drv.has_async_send()) {
+                byte r = drv.send_start(pkt, pkt_len);
+                if (!r) {
+                    // Transmission underway: completion is polled at each
+                    // do_events() pass.
+                    tsk->tx_pending = 1;
+                    tx_task = tsk;
+                    tx_started = get_current_time();
+                    tsk->mtime_wakeup = tx_started;
+                    return tsk->status;
+                }
+                send_post(tsk, r);
+            } else {
+                byte r = drv.send(pkt, pkt_len);
+                send_post(tsk, r);
+            }
+#ifdef RFLINK_WOR
+            if (wake_train_next(tsk))
+                return tsk->status;
+#endif
+        } else {
+            send_ack_missed(tsk);
+        }
+
+        return send_schedule_next(tsk);
+    } else if (tsk->status == ST_SEND_DONE) {
+        return ST_FINISHED;
+    } else if (tsk->status == ST_RECEIVE_DATA_RETRIEVED
+                 || tsk->status == ST_RECEIVE_TIMEDOUT) {
+        return ST_FINISHED;
+    } else if (tsk->status == ST_RECEIVE_DATA_AVAILABLE) {
+        data_retrieved_post(tsk);
+        return ST_RECEIVE_TIMEDOUT;
+    } else if (tsk->status == ST_RECEIVE) {
+        tsk->evtsub_wakeup = 1;
+        tsk->mtime_wakeup = tsk->mtime_ref + DEFAULT_RECEIVE_TIMEOUT_DELAY;
+        return ST_RECEIVE_TIMEDOUT;
+    } else if (tsk->status == ST_DEFERRED_EXEC) {
+        if (tsk->cfg && tsk->cfg->deferred_exec_func) {
+            (*tsk->cfg->deferred_exec_func)(tsk->cfg->deferred_exec_pdata);
+        } else {
+            // A deferred exec task should always own a config in which
+            // deferred_exec_func is non-null.
+            assert(false);
+        }
+        return ST_FINISHED;
+    } else {
+        // Execution shall never arrive here
+        assert(false);
+    }
+
+    // Never executed
+    return ST_NOTHING;
+
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::interrupts_on() {
+    if (!isr_func) {
+        // No interrupt handler available: device is polled
+        interrupted = true;
+        return;
+    }
+    if (!interrupt_is_attached) {
+        interrupt_is_attached = 1;
+        drv.set_interrupt(isr_func);
+//        dbg("enabled interrupts");
+    }
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::interrupts_off() {
+    if (interrupt_is_attached) {
+        interrupt_is_attached = 0;
+        drv.reset_interrupt();
+//        dbg("disabled interrupts");
+    }
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::cache_pktid_hash(address_t src) {
+    // High bits are folded in, so that addresses that differ by their high
+    // bits only (0x12, 0x22, ...) don't all start at the same entry.
+    return (src ^ (src >> 4)) % CacheSize;
+}
+
+static inline void cache_pktid_init(cache_pktid_t* entry, address_t src) {
+    entry->used = 1;
+    entry->pktid_known = 0;
+    entry->lq_known = 0;
+    entry->src = src;
+    entry->last_pktid_seen = 0;
+    entry->window = 0;
+#ifdef RFLINK_AUTO_POWER
+    entry->power_level = POWER_LEVEL_UNKNOWN;
+    entry->power_good_acks = 0;
+#endif
+#ifdef RFLINK_HOP
+    entry->hop_channel = CHANNEL_UNKNOWN;
+#endif
+}
+
+// Remove entry at index idx. Entries that follow it in the same probe
+// sequence are shifted back (backward-shift deletion), so that a probe
+// sequence is never broken, and a lookup of an unknown source stops at the
+// first unused entry.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::cache_pktid_remove(byte idx) {
+    byte j = idx;
+    while (true) {
+        j = (j + 1) % CacheSize;
+        if (j == idx || !cache_pktids[j].used)
+            break;
+        // Entry j stays if its home slot lies cyclically in (idx, j]
+        byte home = cache_pktid_hash(cache_pktids[j].src);
+        if ((j - home + CacheSize) % CacheSize
+            < (j - idx + CacheSize) % CacheSize)
+            continue;
+        cache_pktids[idx] = cache_pktids[j];
+        idx = j;
+    }
+    cache_pktids[idx].used = 0;
+}
+
+// Return the cache entry of source src, creating it if need be (in which case
+// *created is set to true).
+//
+// The cache is an open-addressed hash table (linear probing). An entry not
+// seen since CACHE_PKTID_DISCARD_DELAY is removed when a probe sequence goes
+// over it. If the cache is full, the least recently seen entry is recycled.
+//
+// FIXME
+//   Timing management won't work with auto_sleep() enabled, during periods
+//   where CPU sleeps waiting for a packet, unless RFLINK_WDT_SLEEP is defined.
+//   Not a very big issue though...
+template <class Driver, byte MaxTasks, byte CacheSize>
+cache_pktid_t* RFLinkBase<Driver, MaxTasks, CacheSize>::cache_pktid_get(
+           address_t src, bool* created) {
+    mtime_t tref = get_current_time();
+
+    byte idx = cache_pktid_hash(src);
+    for (unsigned int n = 0; n < CacheSize; ) {
+
+        cache_pktid_t* current = &cache_pktids[idx];
+
+        if (!current->used) {
+            cache_pktid_init(current, src);
+            current->mtime = tref;
+            *created = true;
+            return current;
+        }
+
+        mtime_t elapsed = tref - current->mtime;
+
+        if (current->src == src) {
+//            dbgf("IDrec: match s=0x%02x", src);
+            *created = (elapsed >= CACHE_PKTID_DISCARD_DELAY);
+            if (*created)
+                cache_pktid_init(current, src);
+            current->mtime = tref;
+            return current;
+        }
+
+        // Another entry gets shifted in at idx: it is looked at next.
+        if (elapsed >= CACHE_PKTID_DISCARD_DELAY) {
+            cache_pktid_remove(idx);
+            continue;
+        }
+
+        idx = (idx + 1) % CacheSize;
+        ++n;
+    }
+
+    // Cache is full (no entry got removed above): any entry is on the probe
+    // sequence of src. Looked for once entries no longer move.
+    cache_pktid_t* oldest = cache_pktids;
+    for (byte i = 1; i < CacheSize; ++i) {
+        if ((mtime_t)(tref - cache_pktids[i].mtime)
+            > (mtime_t)(tref - oldest->mtime)) {
+            oldest = &cache_pktids[i];
+        }
+    }
+//    dbgf("IDrec: erase oldest, s=0x%02x", oldest->src);
+    cache_pktid_init(oldest, src);
+    oldest->mtime = tref;
+    *created = true;
+
+    return oldest;
+}
+
+// Same as cache_pktid_get(), without creating an entry nor updating it.
+// Return nullptr if src is not in the cache.
+template <class Driver, byte MaxTasks, byte CacheSize>
+const cache_pktid_t* RFLinkBase<Driver, MaxTasks, CacheSize>::cache_pktid_find(
+           address_t src) {
+    mtime_t tref = get_current_time();
+    byte idx = cache_pktid_hash(src);
+    for (unsigned int n = 0; n < CacheSize; ++n) {
+        const cache_pktid_t* current = &cache_pktids[idx];
+        if (!current->used)
+            break;
+        if (current->src == src) {
+            if ((mtime_t)(tref - current->mtime) >= CACHE_PKTID_DISCARD_DELAY)
+                break;
+            return current;
+        }
+        idx = (idx + 1) % CacheSize;
+    }
+    return nullptr;
+}
+
+// Packet ids are compared modulo the pktid_t range: an id is 'ahead' of another
+// one if it is less than half of this range ahead.
+#define PKTID_HALF_RANGE ((pktid_t)(((pktid_t)~(pktid_t)0) / 2 + 1))
+
+// Any packet id inside the window of a source (the PKTID_WINDOW_SIZE ids up to
+// the most recent one) is reported once only, even if ids arrive out of
+// order.
+// The source has restarted its numbering (typically, the device got reset,
+// and starts over from id 1) if the id is older than the window, or if it is
+// not ahead and comes PKTID_DUP_DELAY or later after the most recent one (a
+// repeated sending comes sooner): the window is then started over.
+template <class Driver, byte MaxTasks, byte CacheSize>
+bool RFLinkBase<Driver, MaxTasks, CacheSize>::check_pktid_already_seen(
+           address_t src, pktid_t pktid) {
+    bool created;
+    cache_pktid_t* entry = cache_pktid_get(src, &created);
+    mtime_t now = get_current_time();
+
+    pktid_t ahead = pktid - entry->last_pktid_seen;
+    pktid_t behind = entry->last_pktid_seen - pktid;
+    bool is_ahead = (ahead && ahead < PKTID_HALF_RANGE);
+
+    // An entry can be created by a sending (see power_apply()), in which case
+    // no packet id is known yet.
+    if (!entry->pktid_known
+        || (!is_ahead && behind >= PKTID_WINDOW_SIZE)
+        || (!is_ahead && now - entry->pktid_mtime >= PKTID_DUP_DELAY)) {
+        entry->pktid_known = 1;
+        entry->last_pktid_seen = pktid;
+        entry->pktid_mtime = now;
+        entry->window = 1;
+        return false;
+    }
+
+    if (is_ahead) {
+        if (ahead >= PKTID_WINDOW_SIZE)
+            entry->window = 0;
+        else
+            entry->window <<= ahead;
+        entry->window |= 1;
+        entry->last_pktid_seen = pktid;
+        entry->pktid_mtime = now;
+        return false;
+    }
+
+    pktid_window_t bit = ((pktid_window_t)1 << behind);
+    if (entry->window & bit)
+        return true;
+
+    entry->window |= bit;
+    return false;
+}
+
+// Smoothed link quality (exponential moving average) of each source
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::update_link_quality(
+           address_t src, const RxInfo* rxinfo) {
+    if (rxinfo->rssi == RSSI_UNKNOWN)
+        return;
+
+    bool created;
+    cache_pktid_t* entry = cache_pktid_get(src, &created);
+
+    int16_t rssi16 = (int16_t)rxinfo->rssi * 16;
+    if (!entry->lq_known) {
+        entry->lq_known = 1;
+        entry->rssi_avg = rssi16;
+        entry->lqi_avg = rxinfo->lqi;
+    } else {
+        entry->rssi_avg += (rssi16 - entry->rssi_avg) / 8;
+        entry->lqi_avg += ((int16_t)rxinfo->lqi - entry->lqi_avg) / 8;
+    }
+}
+
+// Smoothed link quality of packets received from addr.
+// Returns false if not known.
+template <class Driver, byte MaxTasks, byte CacheSize>
+bool RFLinkBase<Driver, MaxTasks, CacheSize>::get_link_quality(
+           address_t addr, RxInfo* avg) {
+    const cache_pktid_t* entry = cache_pktid_find(addr);
+    if (!entry || !entry->lq_known)
+        return false;
+
+    avg->rssi = entry->rssi_avg / 16;
+    avg->lqi = entry->lqi_avg;
+    avg->crc_ok = true;
+    return true;
+}
+
+#ifdef RFLINK_AUTO_POWER
+// Automatic emission power: each destination has its own power level, that
+// starts at the highest one.
+// The device is told about a new power level only when it changes.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::power_apply(address_t dst) {
+    if (!power_nb_levels)
+        return;
+
+    byte level = power_nb_levels - 1;
+    if (dst != ADDR_BROADCAST) {
+        const cache_pktid_t* entry = cache_pktid_find(dst);
+        if (entry && entry->power_level < power_nb_levels)
+            level = entry->power_level;
+    }
+
+    if (level != power_level_applied) {
+        dbgf("power level: %i (d=0x%02x)", level, dst);
+        drv.set_opt(OPT_EMISSION_POWER_LEVEL, &level, sizeof(level));
+        power_level_applied = level;
+    }
+}
+
+// Hysteresis: an ACK with an RSSI between power_rssi_low and power_rssi_high
+// leaves the power level unchanged.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::power_on_ack(
+           address_t dst, int8_t rssi) {
+    if (!power_nb_levels || rssi == RSSI_UNKNOWN)
+        return;
+
+    bool created;
+    cache_pktid_t* entry = cache_pktid_get(dst, &created);
+    if (entry->power_level >= power_nb_levels)
+        entry->power_level = power_nb_levels - 1;
+
+    if (rssi < power_rssi_low) {
+        entry->power_good_acks = 0;
+        if (entry->power_level < power_nb_levels - 1)
+            entry->power_level++;
+    } else if (rssi > power_rssi_high) {
+        entry->power_good_acks++;
+        if (entry->power_good_acks >= AUTO_POWER_STEP_DOWN_ACKS) {
+            entry->power_good_acks = 0;
+            if (entry->power_level)
+                entry->power_level--;
+        }
+    } else {
+        entry->power_good_acks = 0;
+    }
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::power_on_missed_ack(
+           address_t dst) {
+    if (!power_nb_levels || dst == ADDR_BROADCAST)
+        return;
+
+    bool created;
+    cache_pktid_t* entry = cache_pktid_get(dst, &created);
+    entry->power_good_acks = 0;
+    if (entry->power_level < power_nb_levels - 1)
+        entry->power_level++;
+}
+#endif
+
+#ifdef RFLINK_AUTO_RATE
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::rate_apply(byte rate) {
+    // Device is transmitting: switch is done once it is over (see
+    // do_events()).
+    if (tx_task) {
+        rate_next = rate;
+        rate_switch = get_current_time();
+        return;
+    }
+    dbgf("data rate: %i", rate);
+    drv.set_opt(OPT_DATA_RATE, &rate, sizeof(rate));
+    rate_cur = rate;
+    rate_next = rate;
+    if (rate_bitrates)
+        bitrate = rate_bitrates[rate];
+    rate_last_rx = get_current_time();
+}
+
+// Each ACK (sent or received) sets the rate switched to. The switch is
+// scheduled when this rate changes, later ACKs proposing the same rate leave
+// it as is.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::rate_propose(byte rate) {
+    if (rate == rate_next)
+        return;
+    rate_next = rate;
+    rate_switch = get_current_time() + AUTO_RATE_SWITCH_DELAY;
+}
+
+// The device has one data rate: once a second peer is seen, rate goes back
+// to base rate for good.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::rate_on_peer(address_t addr) {
+    if (!rate_nb || rate_multi_peers || addr == ADDR_BROADCAST)
+        return;
+    if (!rate_peer_known) {
+        rate_peer = addr;
+        rate_peer_known = 1;
+    } else if (addr != rate_peer) {
+        dbgf("data rate: second peer 0x%02x, back to base rate", addr);
+        rate_multi_peers = 1;
+        rate_apply(0);
+    }
+}
+#endif
+
+#ifdef RFLINK_HOP
+// Frequency hopping
+//
+// Sender and receiver share a sequence of channels, worked out from the
+// number of channels and the seed (see OPT_HOP_CHANNELS and OPT_HOP_SEED).
+// Sending number k of a packet occurs on channel hop_seq[(i + k) % n], i
+// being the index of the channel the destination was last heard on (or, if
+// unknown, pktid % n): repeated sendings go out on other channels than the
+// first one. The sender stays on the channel to wait for the ACK.
+// The receiver stays on a channel as long as it receives packets on it, and
+// after HOP_DWELL_DELAY without any, hops to the next channel of the sequence
+// (skipping a channel found busy, when device tells it). It sends ACK on the
+// channel the packet got received on.
+// As long as the number of channels does not exceed the number of sendings of
+// a schedule, one of the sendings meets the receiver.
+//
+// IMPORTANT
+//   Needs be set the same on both sides.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::hop_build() {
+    for (byte i = 0; i < hop_nb; ++i)
+        hop_seq[i] = i * HOP_CHANNEL_STEP;
+
+    // Fisher-Yates shuffle, drawn with a xorshift seeded with hop_seed
+    uint16_t x = (hop_seed ? hop_seed : 1);
+    for (byte i = hop_nb; i > 1; --i) {
+        x ^= x << 7;
+        x ^= x >> 9;
+        x ^= x << 8;
+        byte j = x % i;
+        byte tmp = hop_seq[i - 1];
+        hop_seq[i - 1] = hop_seq[j];
+        hop_seq[j] = tmp;
+    }
+
+    hop_idx = 0;
+    hop_next = get_current_time();
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::hop_apply(byte channel) {
+    if (channel != channel_applied) {
+        drv.set_opt(OPT_CHANNEL, &channel, sizeof(channel));
+        channel_applied = channel;
+    }
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::hop_send(const Task* tsk) {
+    if (!hop_nb)
+        return;
+
+    if (tsk->is_an_ack) {
+        hop_apply(hop_rx_channel);
+        return;
+    }
+
+    Header h = tsk->pktkeeper.get_header();
+    byte start = h.pktid % hop_nb;
+    if (h.dst != ADDR_BROADCAST) {
+        const cache_pktid_t* entry = cache_pktid_find(h.dst);
+        for (byte i = 0; entry && i < hop_nb; ++i) {
+            if (hop_seq[i] == entry->hop_channel) {
+                start = i;
+                break;
+            }
+        }
+    }
+    hop_apply(hop_seq[(start + tsk->nbsend) % hop_nb]);
+}
+
+// A packet got received: stay on this channel.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::hop_on_received(address_t src) {
+    hop_rx_channel = channel_applied;
+
+    bool created;
+    cache_pktid_t* entry = cache_pktid_get(src, &created);
+    entry->hop_channel = hop_rx_channel;
+
+    if (hop_rx_channel == hop_seq[hop_idx])
+        hop_next = get_current_time() + HOP_DWELL_DELAY;
+}
+
+// Called at each do_events() pass: once sendings are over, device goes back to
+// the channel listened to, and after HOP_DWELL_DELAY without receiving, to the
+// next channel.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::hop_on_events() {
+    if (tx_task)
+        return;
+    for (Task* tsk = tasks; tsk != tasks + MaxTasks; ++tsk) {
+        if (tsk->status == ST_SEND)
+            return;
+    }
+
+    mtime_t now = get_current_time();
+    if ((long int)(now - hop_next) < 0) {
+        hop_apply(hop_seq[hop_idx]);
+        return;
+    }
+
+    hop_next = now + HOP_DWELL_DELAY;
+    for (byte i = 0; i < hop_nb; ++i) {
+        hop_idx = (hop_idx + 1) % hop_nb;
+        hop_apply(hop_seq[hop_idx]);
+        if (drv.channel_is_clear())
+            break;
+        dbgf("hop: channel %i busy, skipped", hop_seq[hop_idx]);
+    }
+}
+#endif
+
+#ifdef RFLINK_WOR
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::wor_apply(uint16_t period) {
+    if (period == wor_applied || !drv.can_set_opt())
+        return;
+    drv.set_opt(OPT_WOR_PERIOD, &period, sizeof(period));
+    wor_applied = period;
+}
+
+// Called at each do_events() pass: device listens continuously while a
+// sending is underway (an ACK can come in at any time), and goes back to WOR
+// once it is over. Device is left alone while transmitting.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::wor_on_events() {
+    if (tx_task)
+        return;
+    bool sending = false;
+    for (Task* tsk = tasks; !sending && tsk != tasks + MaxTasks; ++tsk) {
+        if (tsk->status == ST_SEND)
+            sending = true;
+    }
+    wor_apply(sending ? 0 : wor_period);
+}
+#endif
+
+// After a device reset, settings applied by the link are set again, so that
+// device and link agree whatever the reset leaves of them.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::device_reapply() {
+    if (!drv.can_set_opt())
+        return;
+
+    if (power_level_applied != POWER_LEVEL_UNKNOWN) {
+        byte level = power_level_applied;
+        drv.set_opt(OPT_EMISSION_POWER_LEVEL, &level, sizeof(level));
+    }
+#ifdef RFLINK_AUTO_RATE
+    if (rate_nb) {
+        byte rate = rate_cur;
+        drv.set_opt(OPT_DATA_RATE, &rate, sizeof(rate));
+    }
+#endif
+    if (channel_applied != CHANNEL_UNKNOWN) {
+        byte channel = channel_applied;
+        drv.set_opt(OPT_CHANNEL, &channel, sizeof(channel));
+    }
+#ifdef RFLINK_WOR
+    if (wor_applied) {
+        uint16_t period = wor_applied;
+        drv.set_opt(OPT_WOR_PERIOD, &period, sizeof(period));
+    }
+#endif
+}
+
+#ifdef RFLINK_WOR
+template <class Driver, byte MaxTasks, byte CacheSize>
+uint16_t RFLinkBase<Driver, MaxTasks, CacheSize>::wake_up_period(
+           address_t dst) const {
+    for (byte i = 0; i < WAKE_UP_MAX_DESTINATIONS; ++i) {
+        if (wake_period[i] && wake_dst[i] == dst)
+            return wake_period[i];
+    }
+    return 0;
+}
+
+// Wake-up train: the frame just sent goes out again, until the WOR period of
+// destination is elapsed, so that destination wakes up during one of them.
+// Return false once the train is over, the schedule being then shifted by the
+// train duration. Without ACK, one train makes the whole sending.
+template <class Driver, byte MaxTasks, byte CacheSize>
+bool RFLinkBase<Driver, MaxTasks, CacheSize>::wake_train_next(Task* tsk) {
+    if (tsk->is_an_ack || tsk->has_received_ack)
+        return false;
+    uint16_t period = wake_up_period(tsk->pktkeeper.get_header().dst);
+    if (!period)
+        return false;
+
+    mtime_t sched = tsk->send_schedule_ptr[tsk->send_schedule_pos];
+    mtime_t now = get_current_time();
+    if ((now - (tsk->mtime_ref + sched)) < period) {
+        tsk->wake_train = 1;
+        tsk->mtime_wakeup = now + (tsk->need_ack ? WAKE_UP_ACK_GAP : 0);
+        return true;
+    }
+    tsk->mtime_ref = now - sched;
+    if (!tsk->need_ack)
+        tsk->send_schedule_pos = tsk->nb_send_schedules - 1;
+    return false;
+}
+#endif
+
+#ifdef RFLINK_TDMA
+// Superframe: slot of coordinator, then one slot per entry of slot map
+template <class Driver, byte MaxTasks, byte CacheSize>
+mtime_t RFLinkBase<Driver, MaxTasks, CacheSize>::tdma_superframe() const {
+    return (mtime_t)(tdma_nb_slots + 1) * tdma_slot_len;
+}
+
+// Delay until a frame of the given airtime can be sent, zero if it can be now.
+// The frame and its ACK (taken as long as the frame) need fit in own slot,
+// TDMA_GUARD away from slot boundaries.
+// A node out of sync, or that got no slot, sends at any time.
+template <class Driver, byte MaxTasks, byte CacheSize>
+mtime_t RFLinkBase<Driver, MaxTasks, CacheSize>::tdma_delay(uint32_t airtime) {
+    if (!tdma_nb_slots || tdma_slot == TDMA_SLOT_NONE
+        || (tdma_node && !tdma_synced)) {
+        return 0;
+    }
+
+    mtime_t frame = tdma_superframe();
+    mtime_t pos = (get_current_time() - tdma_ref) % frame;
+    mtime_t start = (mtime_t)tdma_slot * tdma_slot_len + TDMA_GUARD;
+    mtime_t room = tdma_slot_len - 2 * TDMA_GUARD;
+    mtime_t need = 2 * airtime / 1000 + 1;
+    if (need > room)
+        need = room;
+
+    if (pos >= start && pos + need <= start + room)
+        return 0;
+    return (pos < start ? start - pos : frame - pos + start);
+}
+
+// A node listens until it is in sync, then around beacons only.
+template <class Driver, byte MaxTasks, byte CacheSize>
+bool RFLinkBase<Driver, MaxTasks, CacheSize>::tdma_listening() {
+    if (!tdma_node)
+        return false;
+    if (!tdma_synced)
+        return true;
+
+    mtime_t frame = tdma_superframe();
+    mtime_t pos = (get_current_time() - tdma_ref) % frame;
+    return (pos < TDMA_BEACON_WINDOW || pos + TDMA_BEACON_WINDOW >= frame);
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::tdma_send_beacon() {
+    byte len = TDMA_BEACON_HEADER_LEN + tdma_nb_slots;
+    if (len > max_payload_len) {
+        dbg("tdma: slot map too long for a beacon");
+        return;
+    }
+
+    byte buf[TDMA_BEACON_HEADER_LEN + TDMA_MAX_SLOTS];
+    mtime_t t = tdma_ref;
+    for (byte i = 0; i < 4; ++i)
+        buf[i] = (byte)(t >> (8 * i));
+    buf[4] = (byte)tdma_slot_len;
+    buf[5] = (byte)(tdma_slot_len >> 8);
+    buf[6] = tdma_nb_slots;
+    // Delay is set at the time of sending, see tev_wakeup()
+    buf[7] = 0;
+    buf[8] = 0;
+    for (byte i = 0; i < tdma_nb_slots; ++i)
+        buf[TDMA_BEACON_HEADER_LEN + i] = tdma_map[i];
+
+    taskid_t taskid;
+    if (send_frame_noblock(&taskid, ADDR_BROADCAST, buf, len, false,
+                           FLAG_BEACON) != ERR_TASK_CREATED_OK) {
+        dbg("tdma: could not send beacon");
+        return;
+    }
+
+    // Sent once, with no delay
+    Task* tsk = get_task_by_taskid(taskid);
+    tsk->send_schedule_ptr = snd_repack_sched;
+    tsk->nb_send_schedules = snd_repack_sched_len;
+    tsk->mtime_ref = get_current_time();
+    tsk->mtime_wakeup = tsk->mtime_ref;
+    tsk->unattended = 1;
+}
+
+// Write in beacon the delay since superframe start, at the time of sending.
+// Return false if beacon would end after the listening window of nodes.
+template <class Driver, byte MaxTasks, byte CacheSize>
+bool RFLinkBase<Driver, MaxTasks, CacheSize>::tdma_beacon_stamp(
+           PktKeeper* pk) {
+    byte* b = (byte*)pk->notrecommended_get_pkt_ptr() + WIRE_HEADER_LEN;
+    mtime_t t = 0;
+    for (byte i = 0; i < 4; ++i)
+        t |= (mtime_t)b[i] << (8 * i);
+    mtime_t delay = get_current_time() - t;
+    if (delay + frame_airtime(pk->get_pkt_len()) / 1000 >= TDMA_BEACON_WINDOW)
+        return false;
+    b[7] = (byte)delay;
+    b[8] = (byte)(delay >> 8);
+    return true;
+}
+
+// A node takes superframe start and network time from the beacon, and its
+// slot: the first one that is its own, or else the first shared one.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::tdma_on_beacon(
+           const PktKeeper* pk) {
+    const byte* b = (const byte*)pk->get_data_ptr();
+    byte len = pk->get_data_len();
+    if (len < TDMA_BEACON_HEADER_LEN || !(b[4] | b[5])
+        || len < TDMA_BEACON_HEADER_LEN + b[6]) {
+        dbg("incoming pkt: malformed beacon");
+        return;
+    }
+    // Read well after the start of superframe (device kept it meanwhile, for
+    // example while listening was off): its time of arrival is unknown.
+    if (tdma_synced) {
+        mtime_t frame = tdma_superframe();
+        mtime_t pos = (get_current_time() - tdma_ref) % frame;
+        if (pos >= TDMA_BEACON_WINDOW && pos + TDMA_GUARD < frame) {
+            dbg("tdma: beacon read late, ignored");
+            return;
+        }
+    }
+
+    mtime_t now = get_current_time();
+    mtime_t delay = (mtime_t)b[7] | ((mtime_t)b[8] << 8);
+    mtime_t start = now - frame_airtime(pk->get_pkt_len()) / 1000 - delay;
+    mtime_t t = 0;
+    for (byte i = 0; i < 4; ++i)
+        t |= (mtime_t)b[i] << (8 * i);
+
+    tdma_offset = t - start;
+    tdma_ref = start;
+    tdma_last_beacon = now;
+    tdma_slot_len = (uint16_t)b[4] | ((uint16_t)b[5] << 8);
+    tdma_nb_slots = b[6];
+    tdma_slot = TDMA_SLOT_NONE;
+    for (byte i = 0; i < tdma_nb_slots; ++i) {
+        address_t a = b[TDMA_BEACON_HEADER_LEN + i];
+        if (a == device_addr) {
+            tdma_slot = i + 1;
+            break;
+        }
+        if (a == ADDR_BROADCAST && tdma_slot == TDMA_SLOT_NONE)
+            tdma_slot = i + 1;
+    }
+    tdma_synced = 1;
+}
+
+// Called at each do_events() pass: coordinator sends a beacon at the start of
+// each superframe, node gets out of sync when beacons are missed.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::tdma_on_events() {
+    mtime_t now = get_current_time();
+    mtime_t frame = tdma_superframe();
+
+    if (tdma_coordinator) {
+        if ((now - tdma_ref) >= frame) {
+            tdma_ref += frame;
+            if ((now - tdma_ref) >= frame)
+                tdma_ref = now;
+            tdma_send_beacon();
+        }
+    } else if ((now - tdma_last_beacon) >= TDMA_SYNC_LOST_SUPERFRAMES * frame) {
+        dbg("tdma: out of sync");
+        tdma_synced = 0;
+    }
+}
+#endif
+
+#ifdef RFLINK_AUTO_RATE
+// Data rate proposed to src, according to link quality of packets received
+// from it. Moves one rate at a time.
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::rate_hint(address_t src) {
+    if (rate_multi_peers)
+        return 0;
+
+    RxInfo lq;
+    if (!get_link_quality(src, &lq))
+        return rate_cur;
+
+    if (rate_cur < rate_nb - 1
+        && lq.rssi >= rate_rssi_base + (rate_cur + 1) * AUTO_RATE_RSSI_STEP
+                      + AUTO_RATE_HYSTERESIS) {
+        return rate_cur + 1;
+    }
+    if (rate_cur && lq.rssi < rate_rssi_base + rate_cur * AUTO_RATE_RSSI_STEP)
+        return rate_cur - 1;
+    return rate_cur;
+}
+#endif
+
+// * NOTE ABOUT 'to_execute' ATTRIBUTE *
+// It is used to 'freeze' the task list to execute at the beginning of
+// do_events().
+// That is, tasks created along the way of do_events execution WILL NOT be
+// executed during the same loop - when created, the to_execute attribute is set
+// to 0. Only at the beginning of the next do_events do we set this attribute
+// for all tasks, that means, the tasks created will later be executed normally.
+// Tasks created in-between two calls (like a receive task created right after
+// data got retrieved) are therefore executed by the next call.
+// This mechanism is meant as a safeguard against reentrant calls.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::do_events() {
+
+    if (!drv.registered())
+        return;
+
+    for (Task* tsk = tasks; tsk != tasks + MaxTasks; ++tsk) {
+        if (tsk->status != ST_NOTHING && !tsk->to_execute) {
+            tsk->to_execute = 1;
+        }
+    }
+
+    bool i_want_to_receive = false;
+    for (Task* tsk = tasks; tsk != tasks + MaxTasks; ++tsk) {
+        if (tsk->evtsub_pktrcvd) {
+            i_want_to_receive = true;
+            break;
+        }
+    }
+#ifdef RFLINK_TDMA
+    if (tdma_listening())
+        i_want_to_receive = true;
+#endif
+    if (!drv.can_receive())
+        i_want_to_receive = false;
+
+#ifdef RFLINK_ENERGY
+    if (energy_model)
+        energy_on_events(i_want_to_receive);
+#endif
+
+    if (i_want_to_receive)
+        interrupts_on();
+
+    // If true, pkt contains a packet that we want to hand over to a task
+    bool got_a_pkt = false;
+
+    unsigned long int zzz000 = micros();
+    (void)zzz000;
+
+    if (interrupted) {
+        interrupts_off();
+
+#if defined(RFLINK_DEBUG) && defined(RFLINK_DEBUG_EVENTTIMER_ONLY)
+        mtime_t t0 = get_current_time();
+#endif
+
+        byte nb_bytes_rcvd = 0;
+        bool fec_did_correct = false;
+        if (i_want_to_receive) {
+            initialize_recpkt_if_necessary();
+
+            // FIXME
+            // Writing directly into PktKeeper' packet is not good practice.
+            // Doing it in a clean way will be a bit overkill (imho).
+            if (fec_buf) {
+                uint16_t corrected = 0;
+                byte n = drv.receive(fec_buf, device_max_len);
+                if (n) {
+                    nb_bytes_rcvd =
+                      rflink_fec_decode(fec_buf, n, FEC_CLEAR_LEN,
+                                        recpkt->notrecommended_get_pkt_ptr(),
+                                        &corrected);
+                    if (!nb_bytes_rcvd) {
+                        dbg("incoming pkt: FEC could not correct, or bad "
+                            "FEC CRC");
+#ifdef RFLINK_HEALTH
+                        health.fec_failed++;
+#endif
+                    }
+                }
+                fec_did_correct = (corrected != 0);
+#ifdef RFLINK_HEALTH
+                health.fec_corrected += corrected;
+#endif
+            } else {
+                nb_bytes_rcvd =
+                  drv.receive(
+                     recpkt->notrecommended_get_pkt_ptr(), get_pkt_max_size()
+                  );
+            }
+
+            got_a_pkt =
+              recpkt->check_rcvd_pkt_is_ok(max_payload_len, nb_bytes_rcvd);
+
+            // Device CRC is worked out over what is sent: a packet that FEC
+            // corrected has a bad CRC. FEC CRC, that also covers the
+            // destination address sent in clear, has been checked instead, as
+            // a codeword with three bit errors or more can be miscorrected.
+            if (got_a_pkt && drv.get_rx_info(&rcv_rxinfo)) {
+                if (!rcv_rxinfo.crc_ok && !fec_did_correct) {
+                    dbg("incoming pkt: bad CRC");
+                    got_a_pkt = false;
+                }
+            }
+        }
+
+#ifdef RFLINK_DEBUG
+#ifndef RFLINK_DEBUG_EVENTTIMER_ONLY
+        Header h = recpkt->get_header();
+#endif
+        if (got_a_pkt) {
+            ET_REG(EV_RECEIVE_CALL, t0);
+            ET_REG(EV_RECEIVED_OK);
+            dbgf("incoming pkt:       s=0x%02x, d=0x%02x, fl=0x%02x"
+                   ", pktid=0x%04x, len=%i",
+                   h.src, h.dst, h.flags, h.pktid, h.len);
+        } else if (nb_bytes_rcvd >= WIRE_HEADER_LEN) {
+            ET_REG(EV_RECEIVE_CALL, t0);
+            ET_REG(EV_RECEIVED_NOTOK);
+            dbgf("incoming pkt: packet of incorrect size"
+                   ", len=%i, header.len=%i",
+                   nb_bytes_rcvd, h.len);
+        } else if (nb_bytes_rcvd >= 1) {
+            ET_REG(EV_RECEIVE_CALL, t0);
+            ET_REG(EV_RECEIVED_NOTOK);
+            dbgf("incoming pkt: packet of incorrect size, len=%i",
+                   nb_bytes_rcvd);
+        } else {
+            ET_REG(EV_RECEIVE_CALL, t0);
+            ET_REG(EV_RECEIVED_0_BYTE_RCVD);
+            dbg("incoming pkt: empty packet (no reception)");
+        }
+#endif // RFLINK_DEBUG
+
+        interrupted = false;
+
+        // Device holds more packets: read the next one at next pass, without
+        // waiting for an interrupt.
+        if (i_want_to_receive && drv.pending_frames()) {
+            interrupted = true;
+        }
+
+        interrupts_on();
+    }
+
+#ifdef RFLINK_AUTO_RATE
+    // Automatic data rate: peer is assumed lost after a period of silence,
+    // otherwise, switch agreed upon is done when due (not while device is
+    // transmitting)
+    if (rate_nb && !tx_task) {
+        mtime_t now = get_current_time();
+        if (got_a_pkt)
+            rate_last_rx = now;
+        if (rate_cur && (now - rate_last_rx) >= AUTO_RATE_SILENCE_DELAY)
+            rate_apply(0);
+        else if (rate_next != rate_cur && (long int)(now - rate_switch) >= 0)
+            rate_apply(rate_next);
+    }
+#endif
+
+    mtime_t tref = get_current_time();
+
+    bool pktid_already_seen = false;
+    if (got_a_pkt) {
+        Header h = recpkt->get_header();
+
+        byte seq;
+        byte opt;
+        from_flags(h.flags, &seq, &opt);
+
+        update_link_quality(h.src, &rcv_rxinfo);
+#ifdef RFLINK_AUTO_RATE
+        rate_on_peer(h.src);
+#endif
+
+#ifdef RFLINK_HOP
+        if (hop_nb)
+            hop_on_received(h.src);
+#endif
+
+        // Device receives fine
+        failures_in_a_row = 0;
+
+#ifdef RFLINK_COALESCE
+        // Records of a coalesced frame are still being handed over: a new
+        // coalesced frame is dropped before its pktid is marked as seen. It is
+        // left unacknowledged, so that sender repeats it.
+        if ((opt & FLAG_COAL) && coalpkt.get_pkt_ptr_ro()) {
+            dbg("incoming pkt: records pending, coalesced frame dropped");
+            got_a_pkt = false;
+        }
+#else
+        if (opt & FLAG_COAL) {
+            dbg("incoming pkt: coalesced frame, RFLINK_COALESCE not defined");
+            got_a_pkt = false;
+        }
+#endif
+
+        // An ACK carries the id of the packet it acknowledges, that is, an id
+        // of our own numbering: it must not interfere with ids of its source.
+        if (got_a_pkt && !(opt & FLAG_ACK))
+            pktid_already_seen = check_pktid_already_seen(h.src, h.pktid);
+
+#ifdef RFLINK_AUTO_RATE
+        // A repeated sending: the ACK that proposed a new data rate got lost,
+        // sender is still at current rate. Sender schedules the switch once
+        // it gets the ACK sent again, so does the receiver.
+        if (pktid_already_seen && rate_next != rate_cur)
+            rate_switch = tref + AUTO_RATE_SWITCH_DELAY;
+#endif
+
+        // Beacons are for the link only
+        if (opt & FLAG_BEACON) {
+#ifdef RFLINK_TDMA
+            if (tdma_node && !pktid_already_seen)
+                tdma_on_beacon(recpkt);
+#endif
+            got_a_pkt = false;
+        }
+
+#ifdef RFLINK_COALESCE
+        if (got_a_pkt && (opt & FLAG_COAL) && !pktid_already_seen) {
+            if (recpkt->check_records()) {
+                coalpkt.copy_packet(recpkt);
+                coalpkt_pos = 0;
+                coalpkt_rxinfo = rcv_rxinfo;
+            } else {
+                dbg("incoming pkt: malformed coalesced frame");
+            }
+            got_a_pkt = false;
+        }
+#endif
+    }
+
+#ifdef RFLINK_COALESCE
+    // Records of a coalesced frame are handed over one at a time, as if each of
+    // them had been received on its own, and only when a task is ready to
+    // receive it.
+    if (!got_a_pkt && coalpkt.get_pkt_ptr_ro()) {
+        for (Task* tsk = tasks; tsk != tasks + MaxTasks; ++tsk) {
+            if (tsk->to_execute && tsk->status == ST_RECEIVE) {
+                got_a_pkt = extract_next_record();
+                rcv_rxinfo = coalpkt_rxinfo;
+                break;
+            }
+        }
+    }
+
+    if (coal_len && (long int)(tref - coal_deadline) >= 0)
+        coalesce_flush();
+#endif
+
+    bool device_needs_reset = false;
+
+    for (Task* tsk = tasks; tsk != tasks + MaxTasks; ++tsk) {
+
+        if (!tsk->to_execute)
+            continue;
+
+        byte new_status = tsk->status;
+
+        if (tsk->evtsub_pktrcvd && got_a_pkt) {
+            bool pkt_consumed = false;
+            new_status = tev_received(tsk, recpkt, pktid_already_seen,
+              &pkt_consumed);
+            if (pkt_consumed) {
+                dbgf("incoming pkt: pkt consumed by taskid=%u, st=%i",
+                       tsk->taskid, tsk->status);
+                got_a_pkt = false;
+            }
+        }
+
+        if (tsk->evtsub_wakeup && new_status == tsk->status) {
+            // NOTE
+            // Yes, casting to "signed" works if the difference does not go
+            // beyond the type capacity (here: around 24 days).
+            long int elapsed = (long int)(tref - tsk->mtime_wakeup);
+            if (elapsed >= 0) {
+                new_status = tev_wakeup(tsk);
+            }
+        }
+
+        if (new_status != ST_RECEIVE
+              && new_status != ST_NOTHING
+              && new_status != ST_FINISHED) {
+            if (!tsk->evtsub_wakeup) {
+                dbgf("taskid:%i", tsk->taskid);
+                assert(false);
+            }
+        }
+
+        if (new_status == ST_FINISHED) {
+            if (tsk->status == ST_SEND_DONE && tsk->nbsend
+                  && tsk->need_ack && !tsk->has_received_ack) {
+                device_needs_reset = true;
+#ifdef RFLINK_HEALTH
+                health.acks_missed++;
+#endif
+            }
+            tsk->to_destroy = 1;
+        } else {
+            tsk->status = new_status;
+        }
+    }
+
+    if (got_a_pkt) {
+        dbg("incoming pkt: packet not consumed");
+    }
+
+    // A missing ACK is most often due to a lossy link: try a cheap recovery
+    // first, and reset device only after repeated failures, or if recovery
+    // finds the device in a stuck state.
+    // Both put the device to idle: while a transmission is underway (another
+    // task's), they are deferred until it is over.
+    if (device_needs_reset && tx_task) {
+        device_reset_deferred = true;
+        device_needs_reset = false;
+    } else if (device_reset_deferred && !tx_task) {
+        device_reset_deferred = false;
+        device_needs_reset = true;
+    }
+
+    if (device_needs_reset) {
+        if (failures_in_a_row < 0xFF)
+            failures_in_a_row++;
+
+        if (drv.has_recover()
+            && failures_in_a_row <= DEVICE_RECOVER_MAX_ATTEMPTS) {
+#ifdef RFLINK_HEALTH
+            health.recoveries++;
+#endif
+            if (drv.recover()) {
+                dbg("did recover device");
+                device_needs_reset = false;
+            } else {
+                dbg("device recovery failed");
+            }
+        }
+    }
+
+    if (device_needs_reset) {
+        mtime_t now = get_current_time();
+        if ((now - last_device_reset) >= MIN_DEVICE_RESET_DELAY) {
+            last_device_reset = now;
+            drv.init(nullptr, true);
+            delay(POST_DEVICE_RESET_DELAY);
+            dbg("did reset device");
+
+#ifdef RFLINK_HEALTH
+            health.resets++;
+#endif
+            failures_in_a_row = 0;
+
+            device_reapply();
+        }
+    }
+
+#ifdef RFLINK_HOP
+    if (hop_nb)
+        hop_on_events();
+#endif
+
+#ifdef RFLINK_WOR
+    if (wor_period)
+        wor_on_events();
+#endif
+
+#ifdef RFLINK_TDMA
+    if (tdma_coordinator || tdma_synced)
+        tdma_on_events();
+#endif
+
+    // MANAGE "GO TO SLEEP"
+
+    //   First thing is, to work out whether or not, we are in a status that
+    //   allows to go to sleep.
+    //   The condition is: we are waiting for a packet and that's it (no other
+    //   pending task, no wake-up scheduled)
+
+    byte count_task_evtsub_pktrcvd = 0;
+    byte count_task_evtsub_wakeup = 0;
+    byte count_task_non_nothing = 0;
+    for (Task* tsk = tasks; tsk != tasks + MaxTasks; ++tsk) {
+        if (tsk->evtsub_pktrcvd)
+            count_task_evtsub_pktrcvd++;
+        if (tsk->evtsub_wakeup)
+            count_task_evtsub_wakeup++;
+        else if (tsk->status != ST_NOTHING)
+            count_task_non_nothing++;
+    }
+    bool is_eligible_for_sleep =
+      (count_task_evtsub_pktrcvd == 1
+       && count_task_evtsub_wakeup == 0
+       && count_task_non_nothing == 1
+#ifdef RFLINK_COALESCE
+       && !coal_len
+       && !coalpkt.get_pkt_ptr_ro()
+#endif
+       && !interrupted
+       && !tx_task);
+
+    // Sleep with no deadline: CPU wakes up on a device interrupt only
+    bool sleep_untimed = is_eligible_for_sleep;
+#ifdef RFLINK_WDT_SLEEP
+    mtime_t sleep_delay = 0;
+    if (!is_eligible_for_sleep && auto_sleep)
+        is_eligible_for_sleep = is_eligible_for_timed_sleep(&sleep_delay);
+#endif
+
+    if (is_eligible_for_sleep && auto_sleep) {
+        sleep_enable();
+        set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+        dbg("Going to sleep...");
+#ifdef RFLINK_DEBUG
+        // Needed to have data sent over the serial line, before going to sleep
+        // really.
+        delay(20);
+#endif
+
+        // Device is reset before an untimed sleep only, not at each wake-up
+        // cycle of a timed one.
+        if (sleep_untimed) {
+//            noInterrupts();
+            drv.init(nullptr, true);
+//            interrupts();
+            device_reapply();
+        }
+#ifdef RFLINK_ENERGY
+        mtime_t sleep_start = get_current_time();
+#endif
+#ifdef RFLINK_WDT_SLEEP
+        // No deadline: sleep by watchdog periods all the same, for the time
+        // slept to be known (clock, energy accounting).
+        if (!sleep_delay)
+            sleep_delay = (mtime_t)-1;
+        clock_add_sleep(
+          rflink_wdt_sleep(sleep_delay,
+                           (count_task_evtsub_pktrcvd
+                            ? WDT_SLEEP_MAX_PERIOD_LISTENING : sleep_delay),
+                           &interrupted));
+#else
+        sleep_cpu();
+#endif
+#ifdef RFLINK_ENERGY
+        if (energy_model)
+            energy_on_sleep(get_current_time() - sleep_start);
+#endif
+
+        dbg("WAKE UP!!!");
+    } else if (is_eligible_for_sleep) {
+        if (!last_is_eligible_for_sleep) {
+            dbg("Could go to sleep, but auto_sleep is not activated");
+        }
+    }
+    last_is_eligible_for_sleep = is_eligible_for_sleep;
+
+    for (Task* tsk = tasks; tsk != tasks + MaxTasks; ++tsk) {
+        if (tsk->to_destroy) {
+            task_destroy(tsk);
+        }
+    }
+
+#ifdef RFLINK_DEBUG
+    dbg_print_status(is_eligible_for_sleep);
+#endif
+
+    ET_PRTPERIOD(10000);
+}
+
+#ifdef RFLINK_WDT_SLEEP
+// Sleeping is possible while tasks wait for a deadline, if no sending is
+// underway. *delay is set to the time to sleep, that is, until next deadline.
+template <class Driver, byte MaxTasks, byte CacheSize>
+bool RFLinkBase<Driver, MaxTasks, CacheSize>::is_eligible_for_timed_sleep(
+           mtime_t* delay) {
+    if (interrupted || tx_task)
+        return false;
+#ifdef RFLINK_COALESCE
+    if (coal_len || coalpkt.get_pkt_ptr_ro())
+        return false;
+#endif
+
+    mtime_t now = get_current_time();
+    bool has_deadline = false;
+    mtime_t d = 0;
+    for (Task* tsk = tasks; tsk != tasks + MaxTasks; ++tsk) {
+        // A sending not started yet (deferred to its slot, or by duty cycle)
+        // is a mere deadline.
+        if (tsk->status == ST_SEND && (tsk->nbsend || tsk->tx_pending))
+            return false;
+        if (!tsk->evtsub_wakeup)
+            continue;
+        long int remaining = (long int)(tsk->mtime_wakeup - now);
+        if (remaining < WDT_SLEEP_MIN_DELAY)
+            return false;
+        if (!has_deadline || (mtime_t)remaining < d) {
+            has_deadline = true;
+            d = remaining;
+        }
+    }
+
+#ifdef RFLINK_TDMA
+    // TDMA node: listening window of next beacon is a deadline. Out of sync,
+    // it listens continuously.
+    if (tdma_node) {
+        if (!tdma_synced || tdma_listening())
+            return false;
+        mtime_t frame = tdma_superframe();
+        mtime_t remaining =
+          frame - TDMA_BEACON_WINDOW - (now - tdma_ref) % frame;
+        if (remaining < WDT_SLEEP_MIN_DELAY)
+            return false;
+        if (!has_deadline || remaining < d) {
+            has_deadline = true;
+            d = remaining;
+        }
+    }
+#endif
+
+    if (!has_deadline)
+        return false;
+    *delay = d;
+    return true;
+}
+#endif
+
+#ifdef RFLINK_DEBUG
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::dbg_print_status(
+           bool is_eligible_for_sleep) {
+    static long unsigned print_status_last_t = get_current_time();
+    byte n = 0, a = 0, f = 0, r = 0;
+    for (Task* tsk = tasks; tsk != tasks + MaxTasks; ++tsk) {
+        byte st = tsk->status;
+        if (st == ST_NOTHING)
+            ++n;
+        else if (st == ST_FINISHED)
+            ++f;
+        else
+            ++a;
+        if (st == ST_RECEIVE)
+            ++r;
+    }
+    long unsigned t = get_current_time();
+    if ((t - print_status_last_t) >= 500) {
+        print_status_last_t = t;
+        dbgf("do_events: N=%2i A=%2i F=%2i (R=%2i) tskc=%2i"
+               " (mpl=%i) (soT=%i) (fm=%u) (S=%i)",
+               n, a, f, r, task_count, max_payload_len, sizeof(Task),
+               freeMemory(), is_eligible_for_sleep);
+    }
+}
+#endif // RFLINK_DEBUG
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::send_ack_noblock(
+           taskid_t* taskid, Header* h, const void* data) {
+
+    if (!drv.registered())
+        return ERR_DEVICE_NOT_REGISTERED;
+    else if (!drv.can_send())
+        return ERR_SEND_FUNC_NOT_REGISTERED;
+
+    Task* tsk = task_create(ST_SEND);
+    if (!tsk) {
+        return ERR_UNABLE_TO_CREATE_TASK;
+    }
+
+    *taskid = tsk->taskid;
+
+    tsk->evtsub_wakeup = 1;
+    tsk->send_schedule_ptr = snd_repack_sched;
+    tsk->nb_send_schedules = snd_repack_sched_len;
+    tsk->send_schedule_pos = 0;
+    tsk->mtime_wakeup = tsk->mtime_ref
+                        + tsk->send_schedule_ptr[tsk->send_schedule_pos];
+
+    tsk->is_an_ack = 1;
+    tsk->unattended = 1;
+
+    tsk->pktkeeper.prepare_for_sending(max_payload_len, h, data);
+
+//    dbgf("send_ack_noblock: taskid=%u, s=0x%02x, d=0x%02x, fl=0x%02x"
+//           ", pktid=0x%04u, len=%i",
+//           tsk->taskid, h->src, h->dst, h->flags, h->pktid, h->len);
+
+    return ERR_TASK_CREATED_OK;
+
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::send_noblock(
+           taskid_t* taskid, address_t dst, const void* data, byte len,
+           bool ack) {
+    return send_frame_noblock(taskid, dst, data, len, ack, FLAG_NONE);
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::send_frame_noblock(
+           taskid_t* taskid, address_t dst, const void* data, byte len,
+           bool ack, byte opt) {
+    if (!drv.registered())
+        return ERR_DEVICE_NOT_REGISTERED;
+    else if (!drv.can_send())
+        return ERR_SEND_FUNC_NOT_REGISTERED;
+
+    if (len > max_payload_len)
+        return ERR_SEND_DATA_LEN_ABOVE_LIMIT;
+
+    // NOTE
+    // We don't test the other way round (len != 0 while data being null),
+    // this'd be not bad practice, but a pure bug. And this condition is tested
+    // by prepare_for_sending().
+    if (len == 0 && data != nullptr)
+        return ERR_SEND_BAD_ARGUMENTS;
+
+    Task* tsk = task_create(ST_SEND);
+    if (!tsk) {
+        return ERR_UNABLE_TO_CREATE_TASK;
+    }
+
+    *taskid = tsk->taskid;
+
+    tsk->evtsub_wakeup = 1;
+    tsk->nb_send_schedules = (ack ? snd_expack_sched_len : snd_sched_len);
+    tsk->send_schedule_ptr = (ack ? snd_expack_sched : snd_sched);
+    tsk->send_schedule_pos = 0;
+#ifdef RFLINK_LBT
+    tsk->mtime_ref += draw_send_jitter();
+#endif
+    tsk->mtime_wakeup = tsk->mtime_ref
+                        + tsk->send_schedule_ptr[tsk->send_schedule_pos];
+
+    if (ack) {
+        tsk->need_ack = 1;
+        tsk->evtsub_pktrcvd = 1;
+    }
+
+    Header h;
+    h.src = device_addr;
+    h.dst = dst;
+    h.flags = to_flags(0, (ack ? FLAG_SIN : FLAG_NONE) | opt);
+    h.pktid = ++last_pktid;
+    h.len = len;
+
+    tsk->pktkeeper.prepare_for_sending(max_payload_len, &h, data);
+
+//    dbgf("send_noblock: taskid=%u, s=0x%02x, d=0x%02x, fl=0x%02x"
+//           ", pktid=0x%04u, len=%i",
+//           tsk->taskid, h.src, h.dst, h.flags, h.pktid, h.len);
+
+    return ERR_TASK_CREATED_OK;
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+Task* RFLinkBase<Driver, MaxTasks, CacheSize>::get_task_by_taskid(
+           taskid_t taskid) {
+    for (Task* tsk = tasks; tsk != tasks + MaxTasks; ++tsk) {
+        if (tsk->taskid == taskid) {
+            return tsk;
+        }
+    }
+    return nullptr;
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::task_get_status(taskid_t taskid) {
+    Task* tsk = get_task_by_taskid(taskid);
+
+    if (!tsk)
+        return ST_NOTHING;
+
+    return tsk->status;
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::send_get_final_status(
+           taskid_t taskid, byte* nbsend) {
+    Task* tsk = get_task_by_taskid(taskid);
+    if (!tsk)
+        return ERR_UNKNOWN_TASKID;
+
+    if (tsk->status != ST_SEND_DONE)
+        return ERR_TASK_UNDERWAY;
+
+    byte ret = ERR_UNDEFINED;
+
+    if (tsk->need_ack && tsk->has_received_ack) {
+        ret = ERR_OK;
+    } else if (tsk->last_retcode == ERR_DUTY_CYCLE_EXCEEDED) {
+        ret = ERR_DUTY_CYCLE_EXCEEDED;
+    } else if (tsk->need_ack) {
+        ret = ERR_SEND_NO_ACK_RCVD;
+    } else {
+        ret = tsk->last_retcode;
+    }
+    if (nbsend) {
+        *nbsend = tsk->nbsend;
+    }
+
+    dbgf("taskid=%u: terminating immediately", tsk->taskid);
+
+    tsk->evtsub_wakeup = 1;
+    tsk->mtime_wakeup = get_current_time();
+
+    return ret;
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::send(
+           address_t dst, const void* data, byte len, bool ack, byte *nbsend) {
+    taskid_t taskid;
+    if (!len)
+        data = nullptr;
+    byte r = send_noblock(&taskid, dst, data, len, ack);
+
+    if (r != ERR_TASK_CREATED_OK) {
+        dbgf("send: no task created, error #%i: %s", r, get_err_string(r));
+        return r;
+    }
+
+    while (task_get_status(taskid) == ST_SEND) {
+        do_events();
+    }
+
+    return send_get_final_status(taskid, nbsend);
+}
+
+#ifdef RFLINK_COALESCE
+// Queue a (small) message to be sent along with other messages to the same
+// destination, in one frame made of length-prefixed records.
+// The frame is sent when coalesce_delay is elapsed since the first record got
+// queued, or when it is full, or when a message to another destination (or
+// with another ack requirement) is queued, or when coalesce_flush() is called.
+// The receiver gets back the messages one by one, as if sent separately.
+// If coalesce_delay is zero, the message is sent right away in its own frame.
+// Returns ERR_OK if the message got queued (or sent).
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::send_coalesced(
+           address_t dst, const void* data, byte len, bool ack) {
+    if (!drv.registered())
+        return ERR_DEVICE_NOT_REGISTERED;
+    else if (!drv.can_send())
+        return ERR_SEND_FUNC_NOT_REGISTERED;
+
+    if (!len || !data)
+        return ERR_SEND_BAD_ARGUMENTS;
+
+    // A record takes one more byte, to store its length
+    if (len + 1 > max_payload_len)
+        return ERR_SEND_DATA_LEN_ABOVE_LIMIT;
+
+    byte r;
+    taskid_t taskid;
+
+    if (!coalesce_delay) {
+        r = send_noblock(&taskid, dst, data, len, ack);
+        return (r == ERR_TASK_CREATED_OK ? ERR_OK : r);
+    }
+
+    if (coal_len && (coal_dst != dst || coal_ack != ack
+                     || coal_len + 1 + len > max_payload_len)) {
+        r = coalesce_flush();
+        if (r != ERR_TASK_CREATED_OK)
+            return r;
+    }
+
+    if (!coal_buf) {
+        coal_buf = (byte*)malloc(max_payload_len);
+        if (!coal_buf)
+            return ERR_UNABLE_TO_CREATE_TASK;
+    }
+
+    if (!coal_len) {
+        coal_dst = dst;
+        coal_ack = ack;
+        coal_deadline = get_current_time() + coalesce_delay;
+    }
+
+    coal_buf[coal_len++] = len;
+    memcpy(coal_buf + coal_len, data, len);
+    coal_len += len;
+
+    // No room left for another (non empty) record?
+    if (coal_len + 2 > max_payload_len) {
+        r = coalesce_flush();
+        if (r != ERR_TASK_CREATED_OK)
+            return r;
+    }
+
+    return ERR_OK;
+}
+
+// Send records queued by send_coalesced() now.
+// Returns ERR_OK if there was nothing to send, ERR_TASK_CREATED_OK if a sending
+// task got created (its id is then written in *taskid, if not null), an error
+// code otherwise.
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::coalesce_flush(taskid_t* taskid) {
+    if (!coal_len)
+        return ERR_OK;
+
+    taskid_t t;
+    byte r = send_frame_noblock(&t, coal_dst, coal_buf, coal_len, coal_ack,
+                                FLAG_COAL);
+    if (r != ERR_TASK_CREATED_OK)
+        return r;
+
+    dbgf("coalesce_flush: d=0x%02x, len=%i, taskid=%u", coal_dst, coal_len, t);
+
+    coal_len = 0;
+    if (taskid)
+        *taskid = t;
+
+    return r;
+}
+
+// Hand over the next record of coalpkt, into recpkt.
+// Returns false if there was nothing (valid) to hand over.
+template <class Driver, byte MaxTasks, byte CacheSize>
+bool RFLinkBase<Driver, MaxTasks, CacheSize>::extract_next_record() {
+    bool r = recpkt->extract_record(&coalpkt, &coalpkt_pos);
+    if (!r || coalpkt_pos >= coalpkt.get_data_len())
+        coalpkt.release_data();
+    return r;
+}
+#endif // RFLINK_COALESCE
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::receive_noblock(
+           taskid_t* taskid, RFConfig* cfg) {
+    if (!drv.registered())
+        return ERR_DEVICE_NOT_REGISTERED;
+    else if (!drv.can_receive())
+        return ERR_RECEIVE_FUNC_NOT_REGISTERED;
+
+    Task* tsk = task_create(ST_RECEIVE);
+    if (!tsk) {
+        return ERR_UNABLE_TO_CREATE_TASK;
+    }
+
+    *taskid = tsk->taskid;
+    tsk->evtsub_pktrcvd = 1;
+    if (cfg) {
+        if (cfg->def_timeout) {
+            tsk->evtsub_wakeup = 1;
+            tsk->mtime_wakeup = tsk->mtime_ref + cfg->timeout;
+        }
+    }
+
+//    dbgf("receive_noblock: taskid=%u", tsk->taskid);
+
+    return ERR_TASK_CREATED_OK;
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::send_ack(Task* tsk) {
+    byte seq;
+    byte opt;
+    from_flags(tsk->pktkeeper.get_flags(), &seq, &opt);
+    if (opt & FLAG_SIN) {
+
+        Header h = tsk->pktkeeper.get_header();
+        Header ack_h;
+        ack_h.dst = h.src;
+        ack_h.src = device_addr;
+        ack_h.flags = to_flags(seq, FLAG_ACK);
+        ack_h.pktid = h.pktid;
+        ack_h.len = 0;
+
+        dbgf("sending back ACK for s=0x%02x, d=0x%02x, pktid=0x%04x",
+               ack_h.src, ack_h.dst, ack_h.pktid);
+
+        taskid_t taskid;
+#ifdef RFLINK_AUTO_RATE
+        if (rate_nb) {
+            // Propose a data rate to the sender. Switch to it is scheduled
+            // once the ACK is sent (see send_post()).
+            byte hint = rate_hint(h.src);
+            ack_h.len = sizeof(hint);
+            send_ack_noblock(&taskid, &ack_h, &hint);
+        } else {
+            send_ack_noblock(&taskid, &ack_h);
+        }
+#else
+        send_ack_noblock(&taskid, &ack_h);
+#endif
+    }
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::data_retrieved_post(Task* tsk) {
+    tsk->pktkeeper.reduce_packet_to_its_header();
+    tsk->evtsub_wakeup = 1;
+    tsk->mtime_wakeup = tsk->mtime_ref + receive_purge_delay;
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::data_retrieve(
+           Task* tsk, void* buf, byte buf_len, byte* rec_len, address_t* sender,
+           RxInfo* rxinfo) {
+    if (!tsk)
+        return ST_NOTHING;
+
+    if (tsk->status != ST_RECEIVE_DATA_AVAILABLE)
+        return tsk->status;
+
+#ifdef RFLINK_ENERGY
+    energy.bytes_delivered += tsk->pktkeeper.get_data_len();
+#endif
+    tsk->pktkeeper.copy_data(buf, buf_len, rec_len);
+    if (sender)
+        *sender = tsk->pktkeeper.get_header().src;
+    if (rxinfo)
+        *rxinfo = tsk->rxinfo;
+
+    data_retrieved_post(tsk);
+    tsk->status = ST_RECEIVE_DATA_RETRIEVED;
+
+    send_ack(tsk);
+
+    return tsk->status;
+}
+
+// Same as data_retrieve(), for a task created by receive_noblock()
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::receive_get_data(
+           taskid_t taskid, void* buf, byte buf_len, byte* rec_len,
+           address_t* sender, RxInfo* rxinfo) {
+    return data_retrieve(get_task_by_taskid(taskid), buf, buf_len, rec_len,
+                         sender, rxinfo);
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::receive(
+           void* buf, byte buf_len, byte* rec_len, address_t* sender,
+           RFConfig* cfg, RxInfo* rxinfo) {
+    taskid_t taskid;
+    byte r = receive_noblock(&taskid, cfg);
+
+    do_events();
+
+//    dbgf("receive started, taskid = %u", taskid);
+
+    if (r != ERR_TASK_CREATED_OK) {
+//        dbgf("receive: no task created, error #%i: %s", r, get_err_string(r));
+        return r;
+    }
+
+    while (task_get_status(taskid) == ST_RECEIVE) {
+        do_events();
+    }
+
+    Task* tsk = get_task_by_taskid(taskid);
+    r = data_retrieve(tsk, buf, buf_len, rec_len, sender, rxinfo);
+
+    do_events();
+
+    if (r == ST_RECEIVE_DATA_AVAILABLE || r == ST_RECEIVE) {
+        assert(false);
+    } else if (r == ST_NOTHING) {
+        return ERR_TIMEOUT;
+    } else if (r == ST_RECEIVE_DATA_RETRIEVED) {
+        return ERR_OK;
+    } else if (r == ST_RECEIVE_TIMEDOUT) {
+        return ERR_TIMEOUT;
+    }
+
+    assert(false);
+
+    // Never executed
+    return ERR_UNDEFINED;
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::delay_ms(long int d) {
+    if (d <= 0)
+        return;
+
+    unsigned long int t0 = get_current_time();
+    while ((signed)(get_current_time() - t0) < d) {
+        do_events();
+    }
+}
+
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+taskid_t RFLinkBase<Driver, MaxTasks, CacheSize>::deferred_exec(
+           mtime_t delay, void (*deferred_exec_func)(void *data),
+           void* deferred_exec_pdata) {
+
+    // Not allowed to defer execution of nothing
+    assert(deferred_exec_func);
+
+    Task* tsk = task_create(ST_DEFERRED_EXEC);
+    if (!tsk) {
+        return TASKID_NONE;
+    }
+
+    RFConfig* cfg = new RFConfig;
+    tsk->cfg = cfg;
+
+    cfg->deferred_exec_func = deferred_exec_func;
+    cfg->deferred_exec_pdata = deferred_exec_pdata,
+    tsk->evtsub_wakeup = 1;
+    tsk->mtime_wakeup = tsk->mtime_ref + delay;
+
+    return tsk->taskid;
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::cancel_deferred_exec() {
+    for (Task* tsk = tasks; tsk != tasks + MaxTasks; ++tsk) {
+        if (tsk->status == ST_DEFERRED_EXEC) {
+            tsk->to_destroy = 1;
+        }
+    }
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::set_opt(
+           opt_t opt, void* data, byte len) {
+    if (!drv.can_set_opt())
+        return;
+
+    drv.set_opt(opt, data, len);
+
+    if (opt == OPT_EMISSION_POWER_LEVEL)
+        power_level_applied = *((byte*)data);
+    else if (opt == OPT_EMISSION_POWER)
+        power_level_applied = POWER_LEVEL_UNKNOWN;
+    else if (opt == OPT_CHANNEL)
+        channel_applied = *((byte*)data);
+
+#ifdef RFLINK_HOP
+    if (opt == OPT_HOP_CHANNELS && len == 1) {
+        byte n = *((byte*)data);
+        hop_nb = (n <= HOP_MAX_CHANNELS ? n : HOP_MAX_CHANNELS);
+        hop_build();
+    } else if (opt == OPT_HOP_SEED && len == 2) {
+        hop_seed = *((uint16_t*)data);
+        hop_build();
+    }
+#endif
+#ifdef RFLINK_WOR
+    if (opt == OPT_WOR_PERIOD && len == 2) {
+        wor_period = *((uint16_t*)data);
+        wor_applied = wor_period;
+    }
+#endif
+
+#ifdef ASSUME_DEVICE_ADDRESS_IS_ONE_BYTE
+    if (opt == OPT_ADDRESS) {
+        device_addr_has_been_defined = 1;
+        device_addr = *((byte*)data);
+
+#ifdef RFLINK_LBT
+        rand_state = ((uint16_t)device_addr << 8) ^ (uint16_t)micros();
+        if (!rand_state)
+            rand_state = 1;
+#endif
+    }
+#else
+#error "PLEASE REVIEW THIS CODE HERE: NEED TO HANDLE NOT-1-BYTE-LIKE ADDRESSES"
+#endif
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::set_opt_byte(
+           opt_t opt, byte value) {
+    set_opt(opt, &value, sizeof(value));
+}
+
+// Clock source, returning time in milliseconds, or in microseconds if in_us is
+// true (in which case, time is worked out from the time elapsed between two
+// readings: clock must be read, that is, do_events() called, at least every
+// 71 minutes). Default (nullptr) is millis().
+// Allows a clock that keeps running while CPU sleeps (like a RTC), or, on a
+// host build, a virtual clock.
+// To be called before begin().
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::set_clock(
+           clock_func_t func, bool in_us) {
+    clock_func = func;
+    clock_in_us = in_us;
+    clock_ms = 0;
+    clock_us = (func && in_us ? (*func)() : 0);
+}
+
+// Sleep compensation: add d milliseconds to clock, for a clock that stopped
+// while CPU slept.
+// auto_sleep calls it by itself, when it sleeps with the watchdog (see
+// RFLINK_WDT_SLEEP). With several links, the sketch is to call it for the
+// links that did not sleep.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::clock_add_sleep(mtime_t d) {
+    clock_slept += d;
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+mtime_t RFLinkBase<Driver, MaxTasks, CacheSize>::get_current_time() {
+    if (!clock_func)
+        return millis() + clock_slept;
+    if (!clock_in_us)
+        return (*clock_func)() + clock_slept;
+
+    uint32_t us = (*clock_func)();
+    uint32_t elapsed = us - clock_us;
+    clock_ms += elapsed / 1000;
+    clock_us = us - elapsed % 1000;
+    return clock_ms + clock_slept;
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::set_auto_sleep(bool v) {
+    auto_sleep = v;
+}
+
+#ifdef RFLINK_LBT
+// Listen before talk: before sending, check the channel is clear, and if not,
+// wait for a random delay. Up to max_backoffs delays per sending, after what
+// the packet is sent anyway.
+// Requires channelIsClear function to be registered. Zero disables it.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::set_listen_before_talk(
+           byte max_backoffs) {
+    lbt_max_backoffs = max_backoffs;
+}
+#endif
+
+// Forward error correction: what is sent is encoded so that the receiver can
+// correct errors (see rflink_fec_encode() in rflink.cpp), at the cost of
+// about doubling airtime and halving maximum payload length. The destination
+// address is sent in clear, so that device address filtering keeps working.
+// Meant for noisy channels, where it saves retransmissions.
+// Returns false (and leaves it unchanged) if records are queued by
+// send_coalesced() or a sending is underway, as they are sized after the
+// current maximum payload length.
+//
+// IMPORTANT
+//   Needs be set the same on both sides, before anything is sent.
+template <class Driver, byte MaxTasks, byte CacheSize>
+bool RFLinkBase<Driver, MaxTasks, CacheSize>::set_fec(bool v) {
+#ifdef RFLINK_COALESCE
+    if (coal_len)
+        return false;
+#endif
+    for (Task* tsk = tasks; tsk != tasks + MaxTasks; ++tsk) {
+        if (tsk->status == ST_SEND)
+            return false;
+    }
+
+    fec = v;
+    if (device_max_len)
+        payload_setup();
+    return true;
+}
+
+#ifdef RFLINK_WOR
+// Destination dst listens with wake-on-radio, every period milliseconds (see
+// OPT_WOR_PERIOD): each sending to it is repeated as a train of frames lasting
+// period, so that it hears one of them. A period of zero removes dst.
+// Sending to ADDR_BROADCAST is covered by setting dst to ADDR_BROADCAST.
+// Return false if WAKE_UP_MAX_DESTINATIONS destinations are already set.
+//
+// IMPORTANT
+//   A train takes up to period of airtime: mind the duty cycle (see
+//   set_duty_cycle()), that skips repeated sendings once the budget is
+//   exhausted.
+template <class Driver, byte MaxTasks, byte CacheSize>
+bool RFLinkBase<Driver, MaxTasks, CacheSize>::set_wake_up(
+           address_t dst, uint16_t period) {
+    byte free_entry = WAKE_UP_MAX_DESTINATIONS;
+    for (byte i = 0; i < WAKE_UP_MAX_DESTINATIONS; ++i) {
+        if (wake_period[i] && wake_dst[i] == dst) {
+            wake_period[i] = period;
+            return true;
+        }
+        if (!wake_period[i] && free_entry == WAKE_UP_MAX_DESTINATIONS)
+            free_entry = i;
+    }
+    if (!period)
+        return true;
+    if (free_entry == WAKE_UP_MAX_DESTINATIONS)
+        return false;
+    wake_dst[free_entry] = dst;
+    wake_period[free_entry] = period;
+    return true;
+}
+#endif
+
+#ifdef RFLINK_TDMA
+// TDMA coordinator (typically, the gateway): at the start of each superframe,
+// a beacon is broadcast with network time (time of coordinator), slot length
+// and slot map. A superframe is made of nb_slots + 1 slots of slot_len
+// milliseconds: slot 0 is the one of coordinator (beacon, then its own
+// sendings), slot i (i >= 1) the one of node slot_map[i - 1]. ADDR_BROADCAST
+// in slot_map makes a slot shared by nodes that have none.
+// nb_slots zero disables it. See set_tdma_node() for the other side.
+// Returns false (and leaves TDMA unchanged) if the slot map does not fit in a
+// beacon, that is, more than TDMA_MAX_SLOTS slots or, once begin() is done,
+// more than get_max_payload_len() - TDMA_BEACON_HEADER_LEN slots (FEC makes it
+// 15).
+//
+// IMPORTANT
+//   slot_map is not copied, it must remain valid. slot_len must leave room
+//   for a frame and its ACK, plus twice TDMA_GUARD.
+template <class Driver, byte MaxTasks, byte CacheSize>
+bool RFLinkBase<Driver, MaxTasks, CacheSize>::set_tdma_coordinator(
+           uint16_t slot_len, const address_t* slot_map, byte nb_slots) {
+    if (nb_slots > TDMA_MAX_SLOTS
+        || (max_payload_len
+            && TDMA_BEACON_HEADER_LEN + nb_slots > max_payload_len)) {
+        return false;
+    }
+    tdma_coordinator = (nb_slots && slot_len && slot_map);
+    tdma_node = 0;
+    tdma_synced = 0;
+    tdma_nb_slots = (tdma_coordinator ? nb_slots : 0);
+    tdma_slot_len = slot_len;
+    tdma_map = slot_map;
+    tdma_slot = 0;
+    tdma_offset = 0;
+    // First beacon goes out at next do_events() pass
+    tdma_ref = get_current_time() - tdma_superframe();
+    return true;
+}
+
+// TDMA node: take timing and slot from beacons (see set_tdma_coordinator()),
+// and send in own slot only (ACKs excepted), sendings being deferred to it.
+// Unless a task is receiving, device listens around beacons only, and with
+// auto_sleep (see RFLINK_WDT_SLEEP), sleeps in-between.
+// Until a beacon is received, or after TDMA_SYNC_LOST_SUPERFRAMES superframes
+// without beacon, sendings go out at any time.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::set_tdma_node(bool v) {
+    tdma_node = v;
+    tdma_coordinator = 0;
+    tdma_synced = 0;
+    tdma_nb_slots = 0;
+    tdma_slot = TDMA_SLOT_NONE;
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+bool RFLinkBase<Driver, MaxTasks, CacheSize>::tdma_is_synced() const {
+    return tdma_coordinator || tdma_synced;
+}
+
+// Time of TDMA coordinator, once in sync (local time otherwise)
+template <class Driver, byte MaxTasks, byte CacheSize>
+mtime_t RFLinkBase<Driver, MaxTasks, CacheSize>::get_network_time() {
+    return get_current_time() + tdma_offset;
+}
+#endif
+
+#ifdef RFLINK_LBT
+// Add a random delay, between 0 and j milliseconds, to each sending timing
+// (ACKs excepted), so that devices that send at the same time don't keep
+// colliding at each retry.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::set_send_jitter(mtime_t j) {
+    send_jitter = j;
+}
+#endif
+
+// Bitrate (in bits per second) and bytes sent over the air in addition to
+// packet, used to work out airtime.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::set_bitrate(
+           uint32_t bps, byte overhead_bytes) {
+    if (bps)
+        bitrate = bps;
+    frame_overhead = overhead_bytes;
+}
+
+#ifdef RFLINK_DUTY_CYCLE
+// Enforce a duty cycle of permille / 1000 (for example, 10 for 1%), measured
+// over window milliseconds: up to (window * permille / 1000) milliseconds of
+// airtime can be spent in a burst, then, budget is recovered at the duty cycle
+// rate.
+// When budget is exhausted, a first sending is deferred (up to max_defer
+// milliseconds, otherwise it fails with ERR_DUTY_CYCLE_EXCEEDED), and repeated
+// sendings are skipped. ACKs are always sent, and charged to the budget.
+// permille set to zero disables duty cycle enforcement.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::set_duty_cycle(
+           uint16_t permille, mtime_t window, mtime_t max_defer) {
+    if (permille > 1000)
+        permille = 1000;
+
+    duty_permille = permille;
+    duty_max_defer = max_defer;
+
+    if (permille && window > (mtime_t)INT32_MAX / permille)
+        window = (mtime_t)INT32_MAX / permille;
+    airtime_capacity = (int32_t)(window * permille);
+    airtime_tokens = airtime_capacity;
+    airtime_last_refill = get_current_time();
+}
+
+// Remaining airtime budget, in microseconds.
+// Returns UINT32_MAX if no duty cycle is enforced.
+template <class Driver, byte MaxTasks, byte CacheSize>
+uint32_t RFLinkBase<Driver, MaxTasks, CacheSize>::get_airtime_budget() {
+    if (!duty_permille)
+        return UINT32_MAX;
+
+    airtime_refill();
+    return (airtime_tokens > 0 ? (uint32_t)airtime_tokens : 0);
+}
+#endif
+
+#ifdef RFLINK_AUTO_POWER
+// Select emission power automatically, per destination, among nb_levels
+// levels of device (see OPT_EMISSION_POWER_LEVEL). Zero disables it.
+// Power level goes down while ACKs are received with an RSSI above rssi_high,
+// and up when an ACK is missed or received with an RSSI below rssi_low.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::set_auto_power(
+           byte nb_levels, int8_t rssi_low, int8_t rssi_high) {
+    if (!drv.can_set_opt())
+        nb_levels = 0;
+    power_nb_levels = nb_levels;
+    power_rssi_low = rssi_low;
+    power_rssi_high = rssi_high;
+}
+
+// Power level used to send to dst, or POWER_LEVEL_UNKNOWN if automatic
+// emission power is disabled.
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::get_power_level(address_t dst) {
+    if (!power_nb_levels)
+        return POWER_LEVEL_UNKNOWN;
+    if (dst == ADDR_BROADCAST)
+        return power_nb_levels - 1;
+
+    const cache_pktid_t* entry = cache_pktid_find(dst);
+    if (!entry || entry->power_level >= power_nb_levels)
+        return power_nb_levels - 1;
+    return entry->power_level;
+}
+#endif
+
+#ifdef RFLINK_AUTO_RATE
+// Select data rate automatically, among nb_rates rates of device (see
+// OPT_DATA_RATE). Zero disables it. If bitrates is provided (bitrate of each
+// rate, in bits per second), it is used for airtime accounting.
+//
+// The receiver of a packet proposes a rate in the ACK, according to link
+// quality. Both sides switch to it AUTO_RATE_SWITCH_DELAY after the ACK is
+// sent (receiver) or received (sender): if the ACK gets lost, the repeated
+// sending is heard at the current rate, and the switch is postponed.
+// Nothing received during AUTO_RATE_SILENCE_DELAY, and rate goes back to base
+// rate.
+// Return false (auto-rate being disabled) if more than one peer is known.
+//
+// IMPORTANT
+//   Needs be enabled on both sides. As the device has one rate to send and to
+//   receive, it is meant for links between two devices: once a packet is sent
+//   to, or received from, a second peer, rate goes back to base rate for good
+//   (until set_auto_rate() is called again).
+template <class Driver, byte MaxTasks, byte CacheSize>
+bool RFLinkBase<Driver, MaxTasks, CacheSize>::set_auto_rate(
+           byte nb_rates, const uint32_t* bitrates, int8_t rssi_base) {
+    if (!drv.can_set_opt())
+        nb_rates = 0;
+    if (rate_cur && rate_nb)
+        rate_apply(0);
+    else
+        rate_next = rate_cur;
+    rate_peer_known = 0;
+    rate_multi_peers = 0;
+
+    bool r = true;
+    if (nb_rates) {
+        for (const cache_pktid_t* e = cache_pktids;
+             e != cache_pktids + CacheSize; ++e) {
+            if (!e->used || (!e->pktid_known && !e->lq_known))
+                continue;
+            if (rate_peer_known && e->src != rate_peer) {
+                rate_peer_known = 0;
+                nb_rates = 0;
+                r = false;
+                break;
+            }
+            rate_peer = e->src;
+            rate_peer_known = 1;
+        }
+    }
+
+    rate_nb = nb_rates;
+    rate_bitrates = bitrates;
+    rate_rssi_base = rssi_base;
+    if (rate_bitrates && rate_nb)
+        bitrate = rate_bitrates[0];
+    return r;
+}
+#endif
+
+#ifdef RFLINK_HEALTH
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::get_health(RFHealth* h) const {
+    *h = health;
+    h->failures_in_a_row = failures_in_a_row;
+}
+#endif
+
+#ifdef RFLINK_ENERGY
+// Energy accounting: time spent in each state is charged at the current given
+// by model. Null model disables it.
+// IMPORTANT
+//   model is not copied, it must stay valid as long as it is in use.
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::set_energy_model(
+           const RFEnergyModel* model) {
+    energy_model = model;
+    energy_last = get_current_time();
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::get_energy(RFEnergy* e) const {
+    *e = energy;
+    e->energy_mj = 0;
+    e->uj_per_byte = 0;
+    e->battery_hours = 0;
+    const RFEnergyModel* m = energy_model;
+    if (!m)
+        return;
+
+    // Charge in nC (microamps times milliseconds). Sending time is also in
+    // rx_ms or idle_ms, it is taken out of them to be charged per level.
+    mtime_t rx_ms = energy.rx_ms;
+    mtime_t idle_ms = energy.idle_ms;
+    int64_t charge_nc = (int64_t)m->mcu_ua * (rx_ms + idle_ms)
+                        + (int64_t)m->sleep_ua * energy.sleep_ms;
+    if (m->nb_tx_levels && m->tx_ua) {
+        mtime_t tx_idle_ms = energy.tx_ms - energy_tx_rx_ms;
+        rx_ms -= (energy_tx_rx_ms < rx_ms ? energy_tx_rx_ms : rx_ms);
+        idle_ms -= (tx_idle_ms < idle_ms ? tx_idle_ms : idle_ms);
+        for (byte i = 0; i < ENERGY_MAX_TX_LEVELS; ++i) {
+            byte level = (i < m->nb_tx_levels ? i : m->nb_tx_levels - 1);
+            charge_nc += (int64_t)m->tx_ua[level] * energy_tx_level_ms[i];
+        }
+    }
+    charge_nc += (int64_t)m->rx_ua * rx_ms + (int64_t)m->idle_ua * idle_ms;
+    if (charge_nc <= 0)
+        return;
+
+    // nC times mV makes pJ
+    int64_t uj = charge_nc * m->voltage_mv / 1000000;
+    e->energy_mj = (uint32_t)(uj / 1000);
+    if (energy.sleeps_unmeasured)
+        return;
+    if (energy.bytes_delivered)
+        e->uj_per_byte = (uint32_t)(uj / energy.bytes_delivered);
+
+    // Average current (uA) is nC per millisecond elapsed
+    mtime_t elapsed = energy.rx_ms + energy.idle_ms + energy.sleep_ms;
+    if (m->battery_mah && elapsed) {
+        int64_t avg_ua = charge_nc / elapsed;
+        if (avg_ua > 0) {
+            e->battery_hours =
+              (uint32_t)((int64_t)m->battery_mah * 1000 / avg_ua);
+        }
+    }
+}
+
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::reset_energy() {
+    memset(&energy, 0, sizeof(energy));
+    memset(energy_tx_level_ms, 0, sizeof(energy_tx_level_ms));
+    energy_tx_rx_ms = 0;
+    energy_tx_us = 0;
+    energy_last = get_current_time();
+}
+#endif
+
+#ifdef RFLINK_AUTO_RATE
+template <class Driver, byte MaxTasks, byte CacheSize>
+byte RFLinkBase<Driver, MaxTasks, CacheSize>::get_data_rate() const {
+    return rate_cur;
+}
+#endif
+
+#ifdef RFLINK_DUTY_CYCLE
+// Total airtime spent sending, in milliseconds
+template <class Driver, byte MaxTasks, byte CacheSize>
+mtime_t RFLinkBase<Driver, MaxTasks, CacheSize>::get_airtime_used() const {
+    return airtime_used_ms;
+}
+#endif
+
+#ifdef RFLINK_COALESCE
+template <class Driver, byte MaxTasks, byte CacheSize>
+void RFLinkBase<Driver, MaxTasks, CacheSize>::set_coalesce_delay(mtime_t d) {
+    coalesce_delay = d;
+    if (!coalesce_delay)
+        coalesce_flush();
+}
+#endif
+
+#undef PKTID_HALF_RANGE
+
+#pragma pop_macro("dbg")
+#pragma pop_macro("dbgf")
+#pragma pop_macro("dbgbin")
+#pragma pop_macro("ET_REG")
+#pragma pop_macro("ET_PRTPERIOD")
+
+#endif // _RFLINK_IMPL_H
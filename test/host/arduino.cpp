@@ -0,0 +1,45 @@
+// Arduino functions for host builds of test/host.
+// Time is simulated: it goes forward by 20 us at each clock read (so that a
+// busy loop makes progress), and by the delay asked for by delay() and
+// delayMicroseconds(). Runs are then fast, and the same from one run to
+// another.
+
+#include <Arduino.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include <avr/interrupt.h>
+
+unsigned long host_us = 0;
+
+unsigned long micros() {
+    host_us += 20;
+    return host_us;
+}
+
+unsigned long millis() {
+    host_us += 20;
+    return host_us / 1000;
+}
+
+void delay(unsigned long ms) { host_us += ms * 1000; }
+void delayMicroseconds(unsigned int us) { host_us += us; }
+
+void attachInterrupt(uint8_t, void (*)(), int) { }
+void detachInterrupt(uint8_t) { }
+void noInterrupts() { }
+void interrupts() { }
+
+long random(long max) { return rand() % max; }
+long random(long min, long max) { return min + rand() % (max - min); }
+
+void set_sleep_mode(int) { }
+void sleep_enable() { }
+void sleep_disable() { }
+void sleep_cpu() { }
+
+void wdt_disable() { }
+void wdt_reset() { }
+
+volatile uint8_t WDTCSR;
+volatile uint8_t MCUSR;
+
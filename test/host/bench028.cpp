@@ -0,0 +1,56 @@
+// Header serialization cost: header_encode() and header_decode() (field by
+// field, see rflink.cpp) against a memcpy of the Header struct.
+// Build it with optimization (see run.sh), figures are host specific.
+
+// rflink.cpp is included, as header_encode() and header_decode() are static
+#include "../../rflink.cpp"
+
+#include <chrono>
+
+#define NB_LOOPS 100000000L
+
+static Header h;
+static byte wire[sizeof(Header) > WIRE_HEADER_LEN ? sizeof(Header)
+                                                  : WIRE_HEADER_LEN];
+static volatile unsigned sink;
+
+__attribute__((noinline)) static void wire_encode() {
+    header_encode(&h, wire);
+}
+__attribute__((noinline)) static void wire_decode() {
+    header_decode(wire, WIRE_HEADER_LEN, &h);
+}
+__attribute__((noinline)) static void memcpy_encode() {
+    memcpy(wire, &h, sizeof(h));
+}
+__attribute__((noinline)) static void memcpy_decode() {
+    memcpy(&h, wire, sizeof(h));
+}
+
+static void bench(const char* name, void (*func)()) {
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < NB_LOOPS; ++i) {
+        h.pktid = (pktid_t)i;
+        func();
+        sink += wire[3];
+    }
+    auto end = std::chrono::steady_clock::now();
+    printf("%-14s %.2f ns per header\n", name,
+           std::chrono::duration<double, std::nano>(end - start).count()
+           / NB_LOOPS);
+}
+
+int main() {
+    h.dst = 0x12;
+    h.src = 0x34;
+    h.flags = 0x01;
+    h.len = 5;
+
+    bench("memcpy encode", memcpy_encode);
+    bench("wire encode", wire_encode);
+    bench("memcpy decode", memcpy_decode);
+    bench("wire decode", wire_decode);
+
+    return 0;
+}
+
@@ -0,0 +1,86 @@
+#!/usr/bin/bash
+
+set -euo pipefail
+
+#
+# Host harnesses: rflink built for the host (see stubs/ and arduino.cpp), with
+# simulated devices and simulated time. They need no board, and give the same
+# figures from one run to another (benchmarks excepted).
+#
+# Usage: ./run.sh [NAME...]
+# Without argument, runs them all. Binaries are built in BUILD_DIR.
+#
+CXX=${CXX:-g++}
+BUILD_DIR=${BUILD_DIR:-/tmp/rflink-host}
+CXXFLAGS="-std=gnu++11 -O2 -Wall -Istubs -I../.."
+
+ALL="bench028 t031 t035 t044 t045 t049 t050"
+
+cd "$(dirname "$0")"
+mkdir -p "${BUILD_DIR}"
+
+# build NAME [OPTIONS...]
+# OPTIONS are the rflink.h macros the harness needs, as -D options.
+build() {
+    local name=$1
+    shift
+    "${CXX}" ${CXXFLAGS} "$@" -o "${BUILD_DIR}/${name}" "${name}.cpp" \
+        sim.cpp arduino.cpp ../../rflink.cpp
+}
+
+run_one() {
+    local bin="${BUILD_DIR}/$1"
+    case "$1" in
+        bench028)
+            # Includes rflink.cpp itself
+            "${CXX}" ${CXXFLAGS} -o "${bin}" bench028.cpp arduino.cpp
+            "${bin}"
+            ;;
+        t031)
+            build t031 -DRFLINK_LBT
+            "${bin}" 0 0
+            "${bin}" 6 0
+            "${bin}" 0 200
+            "${bin}" 6 200
+            ;;
+        t035)
+            build t035 -DRFLINK_AUTO_RATE
+            "${bin}" -1
+            "${bin}" 2
+            "${bin}" 5
+            ;;
+        t044)
+            build t044 -DRFLINK_HOP
+            "${bin}" 0
+            "${bin}" 4
+            ;;
+        t045)
+            build t045 -DRFLINK_HEALTH
+            "${bin}"
+            "${bin}" 30 0
+            "${bin}" 30 1
+            ;;
+        t049)
+            build t049 -DRFLINK_WOR
+            "${bin}" 500 0
+            "${bin}" 500 1
+            ;;
+        t050)
+            build t050 -DRFLINK_TDMA -DRFLINK_LBT
+            "${bin}" 0 0
+            "${bin}" 0 1
+            "${bin}" 1 0
+            "${bin}" 1 1
+            ;;
+        *)
+            echo "unknown harness: $1" >&2
+            exit 1
+            ;;
+    esac
+}
+
+for name in ${@:-${ALL}}; do
+    echo "[${name}]"
+    run_one "${name}"
+done
+
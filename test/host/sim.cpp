@@ -0,0 +1,168 @@
+// Simulated devices for test/host harnesses, see sim.h.
+
+#include "sim.h"
+
+static byte pop_frame(std::deque<Frame>* q, void* buf, byte buf_len) {
+    if (q->empty())
+        return 0;
+    const Frame& f = q->front();
+    byte n = (f.size() < buf_len ? f.size() : buf_len);
+    memcpy(buf, f.data(), n);
+    q->pop_front();
+    return n;
+}
+
+//
+// Shared medium
+//
+
+struct OnAir {
+    byte from;
+    unsigned long end;
+    bool collided;
+    Frame frame;
+};
+
+byte medium_dev = 0;
+address_t medium_addr[MEDIUM_MAX_DEVICES];
+unsigned long medium_frames = 0;
+unsigned long medium_collided = 0;
+
+static std::vector<OnAir> on_air;
+static std::deque<Frame> medium_rx[MEDIUM_MAX_DEVICES];
+static void (*medium_isr[MEDIUM_MAX_DEVICES])();
+
+void MediumDriver::init(byte* max_data_len, bool) {
+    if (max_data_len)
+        *max_data_len = SIM_MAX_DATA_LEN;
+}
+
+byte MediumDriver::send(const void* data, byte len) {
+    unsigned long t = millis();
+    OnAir a;
+    a.from = medium_dev;
+    a.end = t + ((len + 9) * 8000UL + MEDIUM_BAUD_RATE - 1) / MEDIUM_BAUD_RATE;
+    a.collided = false;
+    a.frame.assign((const byte*)data, (const byte*)data + len);
+    for (auto& o : on_air) {
+        if (o.end > t) {
+            if (!o.collided)
+                ++medium_collided;
+            o.collided = true;
+            a.collided = true;
+        }
+    }
+    if (a.collided)
+        ++medium_collided;
+    ++medium_frames;
+    on_air.push_back(a);
+    return ERR_OK;
+}
+
+byte MediumDriver::receive(void* buf, byte buf_len) {
+    return pop_frame(&medium_rx[medium_dev], buf, buf_len);
+}
+
+byte MediumDriver::pending_frames() {
+    return !medium_rx[medium_dev].empty();
+}
+
+bool MediumDriver::channel_is_clear() {
+    unsigned long t = millis();
+    for (auto& o : on_air) {
+        if (o.end > t)
+            return false;
+    }
+    return true;
+}
+
+void MediumDriver::set_interrupt(void (*func)()) {
+    medium_isr[medium_dev] = func;
+    if (func && !medium_rx[medium_dev].empty())
+        func();
+}
+
+void MediumDriver::reset_interrupt() {
+    medium_isr[medium_dev] = nullptr;
+}
+
+void medium_tick() {
+    unsigned long t = millis();
+    for (size_t i = 0; i < on_air.size(); ) {
+        const OnAir& a = on_air[i];
+        if (a.end > t) {
+            ++i;
+            continue;
+        }
+        address_t dst = a.frame[0];
+        if (!a.collided) {
+            for (byte k = 0; k < MEDIUM_MAX_DEVICES; ++k) {
+                if (k == a.from
+                    || (dst != medium_addr[k] && dst != ADDR_BROADCAST))
+                    continue;
+                medium_rx[k].push_back(a.frame);
+                if (medium_isr[k])
+                    medium_isr[k]();
+            }
+        }
+        on_air.erase(on_air.begin() + i);
+    }
+}
+
+//
+// Point to point
+//
+
+bool (*pair_filter)(byte from, Frame* frame, bool* crc_ok) = nullptr;
+void (*pair_on_opt)(byte dev, opt_t opt, void* data, byte len) = nullptr;
+bool (*pair_channel_is_clear)(byte dev) = nullptr;
+
+static std::deque<Frame> pair_rx[2];
+static std::deque<bool> pair_rx_crc[2];
+static bool pair_last_crc[2];
+static void (*pair_isr[2])();
+
+byte pair_send(byte dev, const void* data, byte len) {
+    Frame f((const byte*)data, (const byte*)data + len);
+    bool crc_ok = true;
+    if (pair_filter && !pair_filter(dev, &f, &crc_ok))
+        return ERR_OK;
+    byte peer = 1 - dev;
+    pair_rx[peer].push_back(f);
+    pair_rx_crc[peer].push_back(crc_ok);
+    if (pair_isr[peer])
+        pair_isr[peer]();
+    return ERR_OK;
+}
+
+byte pair_receive(byte dev, void* buf, byte buf_len) {
+    if (pair_rx[dev].empty())
+        return 0;
+    pair_last_crc[dev] = pair_rx_crc[dev].front();
+    pair_rx_crc[dev].pop_front();
+    return pop_frame(&pair_rx[dev], buf, buf_len);
+}
+
+bool pair_get_rx_info(byte dev, RxInfo* info) {
+    info->rssi = -50;
+    info->lqi = 10;
+    info->crc_ok = pair_last_crc[dev];
+    return true;
+}
+
+byte pair_pending_frames(byte dev) {
+    return !pair_rx[dev].empty();
+}
+
+void pair_set_interrupt(byte dev, void (*func)()) {
+    pair_isr[dev] = func;
+    if (func && !pair_rx[dev].empty())
+        func();
+}
+
+// Frames not yet received by dev are lost
+void pair_clear(byte dev) {
+    pair_rx[dev].clear();
+    pair_rx_crc[dev].clear();
+}
+
@@ -0,0 +1,115 @@
+// Simulated devices for test/host harnesses.
+
+#ifndef _HOST_SIM_H
+#define _HOST_SIM_H
+
+#include "rflink.h"
+
+#include <deque>
+#include <vector>
+
+typedef std::vector<byte> Frame;
+
+// Maximum payload length the simulated devices report
+#define SIM_MAX_DATA_LEN            61
+
+// Shared medium
+// =============
+//
+// Devices 0 to MEDIUM_MAX_DEVICES - 1 share one channel. A frame occupies the
+// air for its airtime, at 38.4 kBaud (9 bytes of preamble, sync word and CRC
+// are added). Frames that overlap in time are all lost. Other frames are
+// delivered at the end of their airtime, to their destination, or to all
+// devices if broadcast.
+//
+// MediumDriver is the same driver for all devices: the device a link works
+// with is medium_dev, to be set before each call to the link.
+
+#define MEDIUM_MAX_DEVICES          25
+#define MEDIUM_BAUD_RATE            38400UL
+
+extern byte medium_dev;
+extern address_t medium_addr[MEDIUM_MAX_DEVICES];
+extern unsigned long medium_frames;
+extern unsigned long medium_collided;
+
+struct MediumDriver : public RFDriver {
+    static void init(byte* max_data_len, bool reset_only);
+    static byte send(const void* data, byte len);
+    static byte receive(void* buf, byte buf_len);
+    static byte pending_frames();
+    static bool channel_is_clear();
+    static void set_interrupt(void (*func)());
+    static void reset_interrupt();
+};
+
+// To be called every millisecond: delivers frames whose airtime is over
+void medium_tick();
+
+// Point to point
+// ==============
+//
+// Two devices, 0 and 1: a frame one sends is received at once by the other,
+// unless pair_filter returns false. pair_filter can also alter the frame, and
+// tell whether device CRC is good. Device options go to pair_on_opt, and
+// channel_is_clear() to pair_channel_is_clear. All three are optional.
+
+extern bool (*pair_filter)(byte from, Frame* frame, bool* crc_ok);
+extern void (*pair_on_opt)(byte dev, opt_t opt, void* data, byte len);
+extern bool (*pair_channel_is_clear)(byte dev);
+
+byte pair_send(byte dev, const void* data, byte len);
+byte pair_receive(byte dev, void* buf, byte buf_len);
+bool pair_get_rx_info(byte dev, RxInfo* info);
+byte pair_pending_frames(byte dev);
+void pair_set_interrupt(byte dev, void (*func)());
+void pair_clear(byte dev);
+
+template <byte K>
+struct PairDriver : public RFDriver {
+    static void init(byte* max_data_len, bool) {
+        if (max_data_len)
+            *max_data_len = SIM_MAX_DATA_LEN;
+    }
+    static byte send(const void* data, byte len) {
+        return pair_send(K, data, len);
+    }
+    static byte receive(void* buf, byte buf_len) {
+        return pair_receive(K, buf, buf_len);
+    }
+    static void set_opt(opt_t opt, void* data, byte len) {
+        if (pair_on_opt)
+            pair_on_opt(K, opt, data, len);
+    }
+    static bool get_rx_info(RxInfo* info) { return pair_get_rx_info(K, info); }
+    static byte pending_frames() { return pair_pending_frames(K); }
+    static bool channel_is_clear() {
+        return !pair_channel_is_clear || pair_channel_is_clear(K);
+    }
+    static void set_interrupt(void (*func)()) { pair_set_interrupt(K, func); }
+    static void reset_interrupt() { pair_set_interrupt(K, nullptr); }
+};
+
+// One millisecond of run time for links a and b, b receiving with task *tb.
+// Returns true if b got a packet.
+template <class A, class B>
+bool pair_step(A* a, B* b, taskid_t* tb) {
+    a->do_events();
+    b->do_events();
+    delay(1);
+
+    bool got = false;
+    byte st = b->task_get_status(*tb);
+    if (st == ST_RECEIVE_DATA_AVAILABLE) {
+        byte buf[SIM_MAX_DATA_LEN];
+        byte len;
+        b->receive_get_data(*tb, buf, sizeof(buf), &len);
+        got = true;
+    }
+    if (st != ST_RECEIVE)
+        b->receive_noblock(tb);
+    return got;
+}
+
+#endif // _HOST_SIM_H
+
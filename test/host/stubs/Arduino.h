@@ -0,0 +1,37 @@
+// Arduino.h for host builds of test/host: just what rflink uses.
+// Time is simulated (see arduino.cpp).
+
+#ifndef _HOST_ARDUINO_H
+#define _HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void attachInterrupt(uint8_t irq, void (*func)(), int mode);
+void detachInterrupt(uint8_t irq);
+void noInterrupts();
+void interrupts();
+
+long random(long max);
+long random(long min, long max);
+
+#define FALLING 2
+#define RISING  3
+
+#define PROGMEM
+#define strcpy_P strcpy
+#define pgm_read_byte(a) (*(const uint8_t*)(a))
+#define pgm_read_word(a) (*(a))
+
+#endif // _HOST_ARDUINO_H
+
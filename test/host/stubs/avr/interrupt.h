@@ -0,0 +1,18 @@
+#ifndef _HOST_AVR_INTERRUPT_H
+#define _HOST_AVR_INTERRUPT_H
+
+#include <stdint.h>
+
+#define ISR(vector) extern "C" void vector(void)
+
+extern volatile uint8_t WDTCSR;
+extern volatile uint8_t MCUSR;
+
+#define WDP3 5
+#define WDIE 6
+#define WDCE 4
+#define WDE  3
+#define WDRF 3
+
+#endif // _HOST_AVR_INTERRUPT_H
+
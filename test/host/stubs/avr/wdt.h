@@ -0,0 +1,8 @@
+#ifndef _HOST_AVR_WDT_H
+#define _HOST_AVR_WDT_H
+
+void wdt_disable();
+void wdt_reset();
+
+#endif // _HOST_AVR_WDT_H
+
@@ -0,0 +1,99 @@
+// Listen before talk and send jitter, on a shared medium (see sim.h).
+// 24 nodes wake up at the same time every PERIOD ms, and each sends a packet
+// to the coordinator, asking for an ACK.
+//
+// Usage: t031 MAX_BACKOFFS JITTER
+// (arguments of set_listen_before_talk() and set_send_jitter())
+//
+// Needs RFLINK_LBT.
+
+#include "sim.h"
+
+#define NB_NODES        24
+#define PERIOD          2000
+#define RUN_TIME        300000UL
+
+static RFLinkBase<MediumDriver, 30> coord;
+static RFLinkBase<MediumDriver, 4> nodes[NB_NODES];
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: t031 MAX_BACKOFFS JITTER\n");
+        return 1;
+    }
+    byte max_backoffs = atoi(argv[1]);
+    mtime_t jitter = atoi(argv[2]);
+
+    medium_dev = 0;
+    medium_addr[0] = 1;
+    coord.begin();
+    coord.set_opt_byte(OPT_ADDRESS, 1);
+    taskid_t tc = 0;
+    coord.receive_noblock(&tc);
+
+    taskid_t tid[NB_NODES];
+    bool busy[NB_NODES];
+    for (byte k = 0; k < NB_NODES; ++k) {
+        medium_dev = k + 1;
+        medium_addr[k + 1] = k + 2;
+        nodes[k].begin();
+        nodes[k].set_opt_byte(OPT_ADDRESS, k + 2);
+        nodes[k].set_listen_before_talk(max_backoffs);
+        nodes[k].set_send_jitter(jitter);
+        busy[k] = false;
+    }
+
+    unsigned long sent = 0;
+    unsigned long acked = 0;
+    unsigned long nb_sendings = 0;
+    unsigned long next = millis() + PERIOD;
+    unsigned long end = millis() + RUN_TIME;
+    while (millis() < end) {
+        bool wake_up = (millis() >= next);
+        if (wake_up)
+            next += PERIOD;
+
+        for (byte k = 0; k < NB_NODES; ++k) {
+            medium_dev = k + 1;
+            if (wake_up && !busy[k]) {
+                byte data[2] = { k, 0 };
+                if (nodes[k].send_noblock(&tid[k], 1, data, sizeof(data), true)
+                    == ERR_TASK_CREATED_OK) {
+                    busy[k] = true;
+                    ++sent;
+                }
+            }
+            nodes[k].do_events();
+            if (busy[k] && nodes[k].task_get_status(tid[k]) != ST_SEND) {
+                byte n = 0;
+                if (nodes[k].send_get_final_status(tid[k], &n) == ERR_OK)
+                    ++acked;
+                nb_sendings += n;
+                busy[k] = false;
+            }
+        }
+
+        medium_dev = 0;
+        coord.do_events();
+        byte st = coord.task_get_status(tc);
+        if (st == ST_RECEIVE_DATA_AVAILABLE) {
+            byte buf[8];
+            byte len;
+            coord.receive_get_data(tc, buf, sizeof(buf), &len);
+        }
+        if (st != ST_RECEIVE)
+            coord.receive_noblock(&tc);
+
+        delay(1);
+        medium_tick();
+    }
+
+    printf("backoffs=%d jitter=%lu: sent=%lu acked=%lu (%.1f%%) "
+           "sendings/pkt=%.2f frames=%lu collided=%lu (%.1f%%)\n",
+           max_backoffs, (unsigned long)jitter, sent, acked,
+           100.0 * acked / sent, (double)nb_sendings / sent, medium_frames,
+           medium_collided, 100.0 * medium_collided / medium_frames);
+
+    return 0;
+}
+
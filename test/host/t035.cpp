@@ -0,0 +1,75 @@
+// Automatic data rate, with one ACK lost (see sim.h, point to point).
+// A frame is heard only if both devices are at the same data rate. Link a
+// sends a packet to b every 300 ms, asking for an ACK. Acknowledgement number
+// DROP_ACK from b is lost (-1: none).
+// Prints for how long, in ms, the two devices were at different rates.
+//
+// Usage: t035 DROP_ACK
+//
+// Needs RFLINK_AUTO_RATE.
+
+#include "sim.h"
+
+#define RUN_TIME        20000UL
+
+static RFLinkBase<PairDriver<0>> a;
+static RFLinkBase<PairDriver<1>> b;
+
+static const uint32_t bitrates[] = { 38400, 76800, 100000, 250000 };
+
+static byte rate[2];
+static int drop_ack;
+static int nb_acks = 0;
+
+static bool filter(byte from, Frame* frame, bool*) {
+    if (from == 1 && ((*frame)[2] & FLAG_ACK) && nb_acks++ == drop_ack)
+        return false;
+    return rate[0] == rate[1];
+}
+
+static void on_opt(byte dev, opt_t opt, void* data, byte) {
+    if (opt == OPT_DATA_RATE)
+        rate[dev] = *(byte*)data;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: t035 DROP_ACK\n");
+        return 1;
+    }
+    drop_ack = atoi(argv[1]);
+    pair_filter = filter;
+    pair_on_opt = on_opt;
+
+    a.begin();
+    b.begin();
+    a.set_opt_byte(OPT_ADDRESS, 1);
+    b.set_opt_byte(OPT_ADDRESS, 2);
+    a.set_auto_rate(4, bitrates);
+    b.set_auto_rate(4, bitrates);
+    taskid_t tb = 0;
+    b.receive_noblock(&tb);
+
+    int sent = 0;
+    int acked = 0;
+    unsigned long desync = 0;
+    unsigned long end = millis() + RUN_TIME;
+    while (millis() < end) {
+        taskid_t ta = 0;
+        a.send_noblock(&ta, 2, "hello", 5, true);
+        ++sent;
+        for (int i = 0; i < 300; ++i) {
+            pair_step(&a, &b, &tb);
+            if (rate[0] != rate[1])
+                ++desync;
+        }
+        if (a.send_get_final_status(ta) == ERR_OK)
+            ++acked;
+    }
+
+    printf("drop_ack=%d: sent=%d acked=%d desync_ms=%lu final rates=%d/%d\n",
+           drop_ack, sent, acked, desync, rate[0], rate[1]);
+
+    return 0;
+}
+
@@ -0,0 +1,90 @@
+// Frequency hopping, with a jammed channel (see sim.h, point to point).
+// A frame is heard only if both devices are on the same channel. Channel 0
+// is jammed: a frame sent on it is lost 90% of the time. Link a sends packets
+// to b for 2 minutes, one at a time, asking for an ACK.
+//
+// Usage: t044 NB_CHANNELS
+// (0: no hopping, devices stay on channel 0)
+//
+// Needs RFLINK_HOP.
+
+#include "sim.h"
+
+#define JAMMED_CHANNEL  0
+#define JAMMED_PERCENT  90
+#define RUN_TIME        120000UL
+
+static RFLinkBase<PairDriver<0>> a;
+static RFLinkBase<PairDriver<1>> b;
+
+static byte channel[2];
+
+static bool filter(byte from, Frame*, bool*) {
+    if (channel[from] != channel[1 - from])
+        return false;
+    return channel[from] != JAMMED_CHANNEL || rand() % 100 >= JAMMED_PERCENT;
+}
+
+static void on_opt(byte dev, opt_t opt, void* data, byte) {
+    if (opt == OPT_CHANNEL) {
+        channel[dev] = *(byte*)data;
+        pair_clear(dev);
+    }
+}
+
+static bool channel_is_clear(byte dev) {
+    return channel[dev] != JAMMED_CHANNEL;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: t044 NB_CHANNELS\n");
+        return 1;
+    }
+    byte nb_channels = atoi(argv[1]);
+    pair_filter = filter;
+    pair_on_opt = on_opt;
+    pair_channel_is_clear = channel_is_clear;
+    srand(1);
+
+    a.begin();
+    b.begin();
+    a.set_opt_byte(OPT_ADDRESS, 1);
+    b.set_opt_byte(OPT_ADDRESS, 2);
+    if (nb_channels) {
+        uint16_t seed = 0x1234;
+        a.set_opt(OPT_HOP_SEED, &seed, sizeof(seed));
+        b.set_opt(OPT_HOP_SEED, &seed, sizeof(seed));
+        a.set_opt_byte(OPT_HOP_CHANNELS, nb_channels);
+        b.set_opt_byte(OPT_HOP_CHANNELS, nb_channels);
+    }
+    taskid_t tb = 0;
+    b.receive_noblock(&tb);
+
+    int sent = 0;
+    int acked = 0;
+    int delivered = 0;
+    unsigned long start = millis();
+    while (millis() - start < RUN_TIME) {
+        taskid_t ta = 0;
+        a.send_noblock(&ta, 2, "hello", 5, true);
+        ++sent;
+        while (a.task_get_status(ta) == ST_SEND) {
+            if (pair_step(&a, &b, &tb))
+                ++delivered;
+        }
+        if (a.send_get_final_status(ta) == ERR_OK)
+            ++acked;
+        for (int i = 0; i < 50; ++i) {
+            if (pair_step(&a, &b, &tb))
+                ++delivered;
+        }
+    }
+
+    double secs = (millis() - start) / 1000.0;
+    printf("channels=%d: sent=%d acked=%d delivered=%d delivered/s=%.2f\n",
+           nb_channels, sent, acked, delivered, delivered / secs);
+
+    return 0;
+}
+
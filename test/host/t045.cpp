@@ -0,0 +1,161 @@
+// Forward error correction.
+//
+// Usage: t045
+//   Checks rflink_fec_encode() and rflink_fec_decode() against bursts of
+//   8 bit errors (to be corrected) and 3 bit errors in one codeword (to be
+//   dropped), and prints the encode + decode time per byte, on the host.
+// Usage: t045 BER FEC
+//   Link a sends packets to b for 2 minutes, one at a time, asking for an
+//   ACK (see sim.h, point to point). Each bit sent is flipped with probability
+//   BER / 10000. The device CRC is then bad, and the device address check
+//   drops a frame whose first byte is not the address of the receiver.
+//   FEC is 0 (off) or 1 (on).
+//
+// Needs RFLINK_HEALTH.
+
+#include "sim.h"
+
+#include <chrono>
+
+#define RUN_TIME        120000UL
+
+static RFLinkBase<PairDriver<0>> a;
+static RFLinkBase<PairDriver<1>> b;
+
+static const address_t addr[2] = { 1, 2 };
+static int ber;
+
+static bool filter(byte from, Frame* frame, bool* crc_ok) {
+    for (auto& c : *frame) {
+        for (byte i = 0; i < 8; ++i) {
+            if (rand() % 10000 < ber) {
+                c ^= (1 << i);
+                *crc_ok = false;
+            }
+        }
+    }
+    address_t dst = (*frame)[0];
+    return dst == addr[1 - from] || dst == ADDR_BROADCAST;
+}
+
+static void check_codec() {
+    byte in[60];
+    byte enc[2 * (sizeof(in) + FEC_CRC_LEN)];
+    byte dec[sizeof(in)];
+    uint16_t corrected = 0;
+
+    // Bursts of 8 bit errors, in the interleaved part
+    srand(1);
+    int bad = 0;
+    int nb_bursts = 0;
+    for (int t = 0; t < 2000; ++t) {
+        byte n = rand() % 30 + 1;
+        for (byte i = 0; i < n; ++i)
+            in[i] = rand();
+        rflink_fec_encode(in, n, 0, enc);
+        int nb_bits = (n + FEC_CRC_LEN) / 4 * 64;
+        if (nb_bits) {
+            int start = rand() % (nb_bits - 7);
+            for (int k = start; k < start + 8; ++k)
+                enc[k / 8] ^= (1 << (k % 8));
+            ++nb_bursts;
+        }
+        byte r = rflink_fec_decode(enc, 2 * (n + FEC_CRC_LEN), 0, dec,
+                                   &corrected);
+        if (r != n || memcmp(in, dec, n))
+            ++bad;
+    }
+    printf("8-bit bursts: %d frames, %d bursts, bad=%d, bits corrected=%u\n",
+           2000, nb_bursts, bad, corrected);
+
+    // 3 bit errors in one codeword of an interleaved group
+    srand(7);
+    int wrong = 0;
+    int dropped = 0;
+    for (int t = 0; t < 20000; ++t) {
+        const byte n = 20;
+        for (byte i = 0; i < n; ++i)
+            in[i] = rand();
+        rflink_fec_encode(in, n, 0, enc);
+        int group = rand() % ((n + FEC_CRC_LEN) / 4);
+        int cw = rand() % 8;
+        int b0 = rand() % 8;
+        int b1 = (b0 + 1 + rand() % 7) % 8;
+        int b2;
+        do {
+            b2 = rand() % 8;
+        } while (b2 == b0 || b2 == b1);
+        for (int bit : { b0, b1, b2 })
+            enc[group * 8 + bit] ^= (1 << cw);
+        uint16_t c = 0;
+        if (!rflink_fec_decode(enc, 2 * (n + FEC_CRC_LEN), 0, dec, &c))
+            ++dropped;
+        else if (memcmp(in, dec, n))
+            ++wrong;
+    }
+    printf("3-bit codeword errors: 20000 frames, dropped=%d, "
+           "accepted with wrong data=%d\n", dropped, wrong);
+
+    auto start = std::chrono::steady_clock::now();
+    volatile byte sink = 0;
+    for (long t = 0; t < 200000; ++t) {
+        rflink_fec_encode(in, sizeof(in), 0, enc);
+        rflink_fec_decode(enc, sizeof(enc), 0, dec, &corrected);
+        sink += dec[0];
+    }
+    auto end = std::chrono::steady_clock::now();
+    printf("encode + decode: %.1f ns per byte (host)\n",
+           std::chrono::duration<double, std::nano>(end - start).count()
+           / (200000.0 * sizeof(in)));
+}
+
+int main(int argc, char** argv) {
+    if (argc == 1) {
+        check_codec();
+        return 0;
+    }
+    if (argc != 3) {
+        fprintf(stderr, "usage: t045 [BER FEC]\n");
+        return 1;
+    }
+    ber = atoi(argv[1]);
+    bool fec = atoi(argv[2]);
+    pair_filter = filter;
+    srand(1);
+
+    a.begin();
+    b.begin();
+    a.set_opt_byte(OPT_ADDRESS, addr[0]);
+    b.set_opt_byte(OPT_ADDRESS, addr[1]);
+    a.set_fec(fec);
+    b.set_fec(fec);
+    taskid_t tb = 0;
+    b.receive_noblock(&tb);
+
+    int sent = 0;
+    int acked = 0;
+    int nb_sendings = 0;
+    unsigned long start = millis();
+    while (millis() - start < RUN_TIME) {
+        taskid_t ta = 0;
+        a.send_noblock(&ta, 2, "hello world!", 12, true);
+        ++sent;
+        while (a.task_get_status(ta) == ST_SEND)
+            pair_step(&a, &b, &tb);
+        byte n = 0;
+        if (a.send_get_final_status(ta, &n) == ERR_OK)
+            ++acked;
+        nb_sendings += n;
+        for (int i = 0; i < 50; ++i)
+            pair_step(&a, &b, &tb);
+    }
+
+    RFHealth h;
+    b.get_health(&h);
+    printf("ber=%d/10000 fec=%d: sent=%d acked=%d sendings/pkt=%.2f "
+           "fec_corrected=%u fec_failed=%u\n", ber, fec, sent, acked,
+           (double)nb_sendings / sent, h.fec_corrected, h.fec_failed);
+
+    return 0;
+}
+
@@ -0,0 +1,84 @@
+// Wake-on-radio, with wake-up trains (see sim.h, point to point).
+// b listens with WOR: it hears a frame only within the 20 ms that follow the
+// start of each WOR period. Link a sends packets to b for 1 minute, one at a
+// time, asking for an ACK.
+//
+// Usage: t049 PERIOD TRAIN
+// (PERIOD: WOR period of b in ms, TRAIN: 1 if a sends wake-up trains to b)
+//
+// Needs RFLINK_WOR.
+
+#include "sim.h"
+
+#define WOR_RX_TIME     20
+#define RUN_TIME        60000UL
+
+static RFLinkBase<PairDriver<0>> a;
+static RFLinkBase<PairDriver<1>> b;
+
+static uint16_t wor_period[2];
+
+static bool filter(byte from, Frame*, bool*) {
+    uint16_t p = wor_period[1 - from];
+    return !p || millis() % p < WOR_RX_TIME;
+}
+
+static void on_opt(byte dev, opt_t opt, void* data, byte) {
+    if (opt == OPT_WOR_PERIOD)
+        wor_period[dev] = *(uint16_t*)data;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: t049 PERIOD TRAIN\n");
+        return 1;
+    }
+    uint16_t period = atoi(argv[1]);
+    bool train = atoi(argv[2]);
+    pair_filter = filter;
+    pair_on_opt = on_opt;
+
+    a.begin();
+    b.begin();
+    a.set_opt_byte(OPT_ADDRESS, 1);
+    b.set_opt_byte(OPT_ADDRESS, 2);
+    b.set_opt(OPT_WOR_PERIOD, &period, sizeof(period));
+    if (train)
+        a.set_wake_up(2, period);
+    taskid_t tb = 0;
+    b.receive_noblock(&tb);
+
+    int sent = 0;
+    int acked = 0;
+    int delivered = 0;
+    int nb_sendings = 0;
+    unsigned long latency = 0;
+    unsigned long end = millis() + RUN_TIME;
+    while (millis() < end) {
+        taskid_t ta = 0;
+        a.send_noblock(&ta, 2, "hello", 5, true);
+        ++sent;
+        unsigned long t = millis();
+        while (a.task_get_status(ta) == ST_SEND) {
+            if (pair_step(&a, &b, &tb))
+                ++delivered;
+        }
+        byte n = 0;
+        if (a.send_get_final_status(ta, &n) == ERR_OK) {
+            ++acked;
+            latency += millis() - t;
+        }
+        nb_sendings += n;
+        for (int i = 0; i < 200; ++i) {
+            if (pair_step(&a, &b, &tb))
+                ++delivered;
+        }
+    }
+
+    printf("period=%u train=%d: sent=%d acked=%d delivered=%d sendings=%d "
+           "avg_latency=%lu\n", period, train, sent, acked, delivered,
+           nb_sendings, acked ? latency / acked : 0);
+
+    return 0;
+}
+
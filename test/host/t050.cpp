@@ -0,0 +1,122 @@
+// TDMA, on a shared medium (see sim.h).
+// 24 nodes send a packet to the coordinator every 2 s, asking for an ACK,
+// for 5 minutes. Nodes add up to 20 ms of send jitter.
+// With TDMA, the coordinator gives one 40 ms slot to each node.
+//
+// Usage: t050 TDMA BURST
+// (TDMA: 1 to use TDMA, BURST: 1 if all nodes start sending at the same time,
+// 0 if each node starts at random within the period)
+//
+// Needs RFLINK_TDMA and RFLINK_LBT.
+
+#include "sim.h"
+
+#define NB_NODES        24
+#define PERIOD          2000
+#define SLOT_LEN        40
+#define RUN_TIME        300000UL
+
+static RFLinkBase<MediumDriver, 60> coord;
+static RFLinkBase<MediumDriver> nodes[NB_NODES];
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: t050 TDMA BURST\n");
+        return 1;
+    }
+    bool tdma = atoi(argv[1]);
+    bool burst = atoi(argv[2]);
+    srand(7);
+
+    medium_dev = 0;
+    medium_addr[0] = 1;
+    coord.begin();
+    coord.set_opt_byte(OPT_ADDRESS, 1);
+    address_t slot_map[NB_NODES];
+    for (byte k = 0; k < NB_NODES; ++k)
+        slot_map[k] = k + 2;
+    if (tdma)
+        coord.set_tdma_coordinator(SLOT_LEN, slot_map, NB_NODES);
+    taskid_t tc = 0;
+    coord.receive_noblock(&tc);
+
+    taskid_t tid[NB_NODES];
+    bool busy[NB_NODES];
+    unsigned long next[NB_NODES];
+    unsigned long t_sent[NB_NODES];
+    unsigned long start = millis() + 3000;
+    for (byte k = 0; k < NB_NODES; ++k) {
+        medium_dev = k + 1;
+        medium_addr[k + 1] = k + 2;
+        nodes[k].begin();
+        nodes[k].set_opt_byte(OPT_ADDRESS, k + 2);
+        nodes[k].set_send_jitter(20);
+        if (tdma)
+            nodes[k].set_tdma_node(true);
+        busy[k] = false;
+        next[k] = start + (burst ? 0 : rand() % PERIOD);
+    }
+
+    unsigned long sent = 0;
+    unsigned long acked = 0;
+    unsigned long nb_sendings = 0;
+    unsigned long latency = 0;
+    unsigned long latency_max = 0;
+    while (millis() < start + RUN_TIME) {
+        unsigned long t = millis();
+        for (byte k = 0; k < NB_NODES; ++k) {
+            medium_dev = k + 1;
+            if (!busy[k] && t >= next[k]) {
+                byte data[5] = { k, 0, 0, 0, 0 };
+                if (nodes[k].send_noblock(&tid[k], 1, data, sizeof(data), true)
+                    == ERR_TASK_CREATED_OK) {
+                    busy[k] = true;
+                    t_sent[k] = t;
+                    ++sent;
+                }
+                next[k] += PERIOD;
+            }
+            nodes[k].do_events();
+            if (busy[k] && nodes[k].task_get_status(tid[k]) != ST_SEND) {
+                byte n = 0;
+                if (nodes[k].send_get_final_status(tid[k], &n) == ERR_OK) {
+                    ++acked;
+                    unsigned long l = millis() - t_sent[k];
+                    latency += l;
+                    if (l > latency_max)
+                        latency_max = l;
+                }
+                nb_sendings += n;
+                busy[k] = false;
+            }
+        }
+
+        medium_dev = 0;
+        coord.do_events();
+        byte st = coord.task_get_status(tc);
+        if (st == ST_RECEIVE_DATA_AVAILABLE) {
+            byte buf[8];
+            byte len;
+            coord.receive_get_data(tc, buf, sizeof(buf), &len);
+        }
+        if (st != ST_RECEIVE)
+            coord.receive_noblock(&tc);
+
+        delay(1);
+        medium_tick();
+    }
+
+    int synced = 0;
+    for (byte k = 0; k < NB_NODES; ++k)
+        synced += nodes[k].tdma_is_synced();
+
+    printf("tdma=%d burst=%d: sent=%lu acked=%lu (%.1f%%) sendings/pkt=%.2f "
+           "frames=%lu collided=%lu (%.1f%%) latency avg=%lu max=%lu "
+           "synced=%d\n", tdma, burst, sent, acked, 100.0 * acked / sent,
+           (double)nb_sendings / sent, medium_frames, medium_collided,
+           100.0 * medium_collided / medium_frames,
+           acked ? latency / acked : 0, latency_max, synced);
+
+    return 0;
+}
+
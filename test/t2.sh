@@ -0,0 +1,60 @@
+#!/usr/bin/bash
+
+set -euo pipefail
+
+#
+# Sender reboot: the sender is reset halfway (opening its port resets the
+# board), and numbers its packets from 1 again. The receiver must deliver the
+# packets of both runs.
+#
+# UPDATE THE BELOW DEPENDING ON THE BOARD TYPE (uno or nano) AND ALSO UPDATE
+# PORTS DEPENDING ON WHERE (ON WHICH DEV PATH) YOUR BOARD ARE PLUGGED.
+#
+BOARD0=nano
+BOARD1=nano
+PORT0=/dev/ttyUSB0
+PORT1=/dev/ttyUSB1
+AMEXE=./am
+
+SND=../examples/example2/sender2/sender2.ino
+RCV=../examples/example2/receiver2/receiver2.ino
+
+OUT0A=tmp0a.out
+OUT0B=tmp0b.out
+OUT1=tmp1.out
+
+echo "[S]"
+"${AMEXE}" -b "${BOARD0}" -p "${PORT0}" "${SND}"
+echo "[R]"
+"${AMEXE}" -b "${BOARD1}" -p "${PORT1}" "${RCV}"
+
+echo ""
+echo "[S]"
+"${AMEXE}" -b "${BOARD0}" -p "${PORT0}" "${SND}" -n -u
+echo "[R]"
+"${AMEXE}" -b "${BOARD1}" -p "${PORT1}" "${RCV}" -n -u
+
+echo ""
+timeout 20 "${AMEXE}" -p "${PORT1}" "${RCV}" -n -c -r \
+    --recordfile "${OUT1}" &
+timeout 9 "${AMEXE}" -p "${PORT0}" "${SND}" -n -c -r \
+    --recordfile "${OUT0A}" || true
+timeout 9 "${AMEXE}" -p "${PORT0}" "${SND}" -n -c -r \
+    --recordfile "${OUT0B}" || true
+
+set +e
+
+AMEXE_BASE=$(basename "${AMEXE}")
+while pgrep "\<${AMEXE_BASE}\>" > /dev/null; do
+    sleep 1
+done
+
+NB_FIRST=$(grep -c "Received from 0xab: '1-Msg'" "${OUT1}")
+NB_FIFTH=$(grep -c "Received from 0xab: '5-Msg'" "${OUT1}")
+
+if [ "${NB_FIRST}" -eq 2 ] && [ "${NB_FIFTH}" -eq 2 ]; then
+    echo "   1: Ok"
+else
+    echo "** 1: packets sent after reboot not received!"
+fi
+